@@ -1,5 +1,8 @@
 grammar Formula;
 
+// Reference grammar. Formulas are parsed by the hand-written DescentParser
+// (FormulaAST.cpp), keep both in sync: TestDescentParserMatchesAntlr compares them.
+
 main
         : expr EOF
         ;
@@ -9,10 +12,17 @@ expr
         | (ADD | SUB) expr  # UnaryOp
         | expr (MUL | DIV) expr  # BinaryOp
         | expr (ADD | SUB) expr  # BinaryOp
+        | FUNCTION '(' (arg (',' arg)*)? ')'  # Call
         | CELL  # Cell
         | NUMBER  # Literal
         ;
 
+// ranges are only allowed as arguments of functions
+arg
+        : CELL ':' CELL  # RangeArg
+        | expr  # ExprArg
+        ;
+
 // number literals cannot be signed, or else 1-2 would be lexed as [1] [-2]
 fragment INT: [-+]? UINT ;
 fragment UINT: [0-9]+ ;
@@ -27,4 +37,5 @@ SUB: '-' ;
 MUL: '*' ;
 DIV: '/' ;
 CELL: [A-Z]+[0-9]+ ;
+FUNCTION: [A-Z]+ ;
 WS: [ \t\n\r]+ -> skip ;
\ No newline at end of file
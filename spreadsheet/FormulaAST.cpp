@@ -4,8 +4,10 @@
 #include "FormulaLexer.h"
 #include "FormulaParser.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
 #include <memory>
 #include <optional>
 #include <sstream>
@@ -75,11 +77,17 @@ namespace ASTImpl {
         virtual ~Expr() = default;
         virtual void Print(std::ostream& out) const = 0;
         virtual void DoPrintFormula(std::ostream& out, ExprPrecedence precedence) const = 0;
-        virtual double Evaluate(std::function<double(Position)> function) const = 0;
+        // appends instructions calculating the expression in postfix order
+        virtual void Compile(Program& program) const = 0;
 
         // higher is tighter
         virtual ExprPrecedence GetPrecedence() const = 0;
 
+        // range argument of a function, such nodes are compiled by the function
+        virtual const CellRange* GetRange() const {
+            return nullptr;
+        }
+
         void PrintFormula(std::ostream& out, ExprPrecedence parent_precedence,
                           bool right_child = false) const {
             auto precedence = GetPrecedence();
@@ -145,25 +153,23 @@ namespace ASTImpl {
                 }
             }
 
-            double Evaluate([[maybe_unused]] std::function<double(Position)> function) const override {
-                if (type_ == Subtract) {
-                    auto result = lhs_->Evaluate(function) - rhs_->Evaluate(function);
-                    return !std::isinf(result) ? result : throw FormulaError(FormulaError::Category::Div0);
-                }
-                if (type_ == Multiply) {
-                    auto result = lhs_->Evaluate(function) * rhs_->Evaluate(function);
-                    return !std::isinf(result) ? result : throw FormulaError(FormulaError::Category::Div0);
-                }
-                if (type_ == Divide) {
-                    auto div = rhs_->Evaluate(function);
-                    if (div == 0 || std::isinf(div)) {
-                        throw FormulaError(FormulaError::Category::Div0);
-                    }
-                    auto result = lhs_->Evaluate(function) / rhs_->Evaluate(function);
-                    return !std::isinf(result) ? result : throw FormulaError(FormulaError::Category::Div0);
+            void Compile(Program& program) const override {
+                lhs_->Compile(program);
+                rhs_->Compile(program);
+                switch (type_) {
+                    case Add:
+                        program.code.push_back({Opcode::Add, 0});
+                        break;
+                    case Subtract:
+                        program.code.push_back({Opcode::Subtract, 0});
+                        break;
+                    case Multiply:
+                        program.code.push_back({Opcode::Multiply, 0});
+                        break;
+                    case Divide:
+                        program.code.push_back({Opcode::Divide, 0});
+                        break;
                 }
-                auto result = lhs_->Evaluate(function) + rhs_->Evaluate(function);
-                return !std::isinf(result) ? result : throw FormulaError(FormulaError::Category::Div0);
             }
 
         private:
@@ -200,11 +206,11 @@ namespace ASTImpl {
                 return EP_UNARY;
             }
 
-            double Evaluate([[maybe_unused]] std::function<double(Position)> function) const override {
+            void Compile(Program& program) const override {
+                operand_->Compile(program);
                 if (type_ == UnaryMinus) {
-                    return operand_->Evaluate(function) * -1;
+                    program.code.push_back({Opcode::Negate, 0});
                 }
-                return operand_->Evaluate(function);
             }
 
         private:
@@ -222,7 +228,8 @@ namespace ASTImpl {
                 if (!cell_->IsValid()) {
                     out << FormulaError::Category::Ref;
                 } else {
-                    out << cell_->ToString();
+                    char buffer[Position::MAX_STRING_LENGTH];
+                    out.write(buffer, cell_->ToChars(buffer));
                 }
             }
 
@@ -234,9 +241,9 @@ namespace ASTImpl {
                 return EP_ATOM;
             }
 
-            double Evaluate(std::function<double(Position)> function) const override {
-                auto result = function(*cell_);
-                return result;
+            void Compile(Program& program) const override {
+                program.code.push_back({Opcode::PushCell, static_cast<uint32_t>(program.cells.size())});
+                program.cells.push_back(*cell_);
             }
 
         private:
@@ -261,14 +268,106 @@ namespace ASTImpl {
                 return EP_ATOM;
             }
 
-            double Evaluate([[maybe_unused]] std::function<double(Position)> function) const override {
-                return value_;
+            void Compile(Program& program) const override {
+                program.code.push_back({Opcode::PushNumber, static_cast<uint32_t>(program.numbers.size())});
+                program.numbers.push_back(value_);
             }
 
         private:
             double value_;
         };
 
+        class RangeExpr final : public Expr {
+        public:
+            explicit RangeExpr(CellRange range)
+                    : range_(range) {
+            }
+
+            void Print(std::ostream& out) const override {
+                out << range_.ToString();
+            }
+
+            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+                Print(out);
+            }
+
+            ExprPrecedence GetPrecedence() const override {
+                return EP_ATOM;
+            }
+
+            const CellRange* GetRange() const override {
+                return &range_;
+            }
+
+            void Compile(Program& /* program */) const override {
+                // the grammar allows ranges in function arguments only
+                assert(false);
+            }
+
+        private:
+            CellRange range_;
+        };
+
+        class FunctionExpr final : public Expr {
+        public:
+            FunctionExpr(Function function, std::vector<std::unique_ptr<Expr>> args)
+                    : function_(function)
+                    , args_(std::move(args)) {
+            }
+
+            void Print(std::ostream& out) const override {
+                out << '(' << GetFunctionName(function_);
+                for (const auto& arg : args_) {
+                    out << ' ';
+                    arg->Print(out);
+                }
+                out << ')';
+            }
+
+            void DoPrintFormula(std::ostream& out, ExprPrecedence /* precedence */) const override {
+                out << GetFunctionName(function_) << '(';
+                bool is_first = true;
+                for (const auto& arg : args_) {
+                    if (!is_first) {
+                        out << ',';
+                    }
+                    // arguments are separated by commas, they never need parentheses
+                    arg->PrintFormula(out, EP_ADD);
+                    is_first = false;
+                }
+                out << ')';
+            }
+
+            ExprPrecedence GetPrecedence() const override {
+                return EP_ATOM;
+            }
+
+            void Compile(Program& program) const override {
+                // expression arguments go to the stack, nested calls may add their
+                // ranges meanwhile, so ranges of this call are appended after them
+                std::vector<CellRange> ranges;
+                uint32_t stack_args = 0;
+                for (const auto& arg : args_) {
+                    if (auto range = arg->GetRange()) {
+                        ranges.push_back(*range);
+                    } else {
+                        arg->Compile(program);
+                        ++stack_args;
+                    }
+                }
+
+                Call call{function_, stack_args, static_cast<uint32_t>(program.ranges.size()),
+                          static_cast<uint32_t>(ranges.size())};
+                program.ranges.insert(program.ranges.end(), ranges.begin(), ranges.end());
+                program.code.push_back({Opcode::Call, static_cast<uint32_t>(program.calls.size())});
+                program.calls.push_back(call);
+            }
+
+        private:
+            Function function_;
+            std::vector<std::unique_ptr<Expr>> args_;
+        };
+
         class ParseASTListener final : public FormulaBaseListener {
         public:
             std::unique_ptr<Expr> MoveRoot() {
@@ -283,6 +382,10 @@ namespace ASTImpl {
                 return std::move(cells_);
             }
 
+            std::vector<CellRange> MoveRanges() {
+                return std::move(ranges_);
+            }
+
         public:
             void exitUnaryOp(FormulaParser::UnaryOpContext* ctx) override {
                 assert(args_.size() >= 1);
@@ -350,6 +453,39 @@ namespace ASTImpl {
                 args_.back() = std::move(node);
             }
 
+            void exitRangeArg(FormulaParser::RangeArgContext* ctx) override {
+                Position corners[2];
+                for (size_t i = 0; i < 2; ++i) {
+                    auto value_str = ctx->CELL(i)->getSymbol()->getText();
+                    corners[i] = Position::FromString(value_str);
+                    if (!corners[i].IsValid()) {
+                        throw FormulaException("Invalid position: " + value_str);
+                    }
+                }
+
+                auto range = CellRange::FromCorners(corners[0], corners[1]);
+                ranges_.push_back(range);
+                args_.push_back(std::make_unique<RangeExpr>(range));
+            }
+
+            void exitCall(FormulaParser::CallContext* ctx) override {
+                auto name = ctx->FUNCTION()->getSymbol()->getText();
+                auto function = FindFunction(name);
+                if (!function) {
+                    throw ParsingError("Unknown function: " + name);
+                }
+
+                // every argument left exactly one node
+                size_t arg_count = ctx->arg().size();
+                assert(args_.size() >= arg_count);
+                auto first_arg = args_.end() - static_cast<std::ptrdiff_t>(arg_count);
+                std::vector<std::unique_ptr<Expr>> call_args(std::make_move_iterator(first_arg),
+                                                             std::make_move_iterator(args_.end()));
+                args_.erase(first_arg, args_.end());
+
+                args_.push_back(std::make_unique<FunctionExpr>(*function, std::move(call_args)));
+            }
+
             void visitErrorNode(antlr4::tree::ErrorNode* node) override {
                 throw ParsingError("Error when parsing: " + node->getSymbol()->getText());
             }
@@ -357,6 +493,7 @@ namespace ASTImpl {
         private:
             std::vector<std::unique_ptr<Expr>> args_;
             std::forward_list<Position> cells_;
+            std::vector<CellRange> ranges_;
         };
 
         class BailErrorListener : public antlr4::BaseErrorListener {
@@ -369,6 +506,275 @@ namespace ASTImpl {
             }
         };
 
+        // Recursive descent parser for the grammar from Formula.g4. Reads tokens
+        // straight from the expression text, no intermediate token stream is built.
+        class DescentParser {
+        public:
+            explicit DescentParser(std::string_view text)
+                    : text_(text) {
+                Advance();
+            }
+
+            std::unique_ptr<Expr> ParseMain() {
+                auto root = ParseAdditive();
+                if (token_.type != Token::End) {
+                    throw ParsingError("Error when parsing: " + std::string(token_.text));
+                }
+                return root;
+            }
+
+            std::forward_list<Position> MoveCells() {
+                return std::move(cells_);
+            }
+
+            std::vector<CellRange> MoveRanges() {
+                return std::move(ranges_);
+            }
+
+        private:
+            struct Token {
+                enum Type {
+                    Number,
+                    Cell,
+                    Function,
+                    Add,
+                    Sub,
+                    Mul,
+                    Div,
+                    LeftParen,
+                    RightParen,
+                    Comma,
+                    Colon,
+                    End,
+                };
+
+                Type type = End;
+                std::string_view text;
+            };
+
+            static bool IsDigit(char c) {
+                return c >= '0' && c <= '9';
+            }
+
+            static bool IsUpper(char c) {
+                return c >= 'A' && c <= 'Z';
+            }
+
+            size_t SkipDigits(size_t pos) const {
+                while (pos < text_.size() && IsDigit(text_[pos])) {
+                    ++pos;
+                }
+                return pos;
+            }
+
+            // NUMBER: UINT EXPONENT? | UINT? '.' UINT EXPONENT?
+            size_t MatchNumber(size_t begin) const {
+                size_t pos = SkipDigits(begin);
+                if (pos < text_.size() && text_[pos] == '.' && pos + 1 < text_.size()
+                    && IsDigit(text_[pos + 1])) {
+                    pos = SkipDigits(pos + 1);
+                }
+                if (pos == begin) {
+                    return begin;
+                }
+                if (pos < text_.size() && (text_[pos] == 'e' || text_[pos] == 'E')) {
+                    size_t exponent = pos + 1;
+                    if (exponent < text_.size() && (text_[exponent] == '+' || text_[exponent] == '-')) {
+                        ++exponent;
+                    }
+                    if (exponent < text_.size() && IsDigit(text_[exponent])) {
+                        pos = SkipDigits(exponent);
+                    }
+                }
+                return pos;
+            }
+
+            void Advance() {
+                while (pos_ < text_.size()
+                       && (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+                    ++pos_;
+                }
+                if (pos_ == text_.size()) {
+                    token_ = {Token::End, "<EOF>"sv};
+                    return;
+                }
+
+                size_t begin = pos_;
+                char c = text_[pos_];
+                Token::Type type;
+                switch (c) {
+                    case '+': type = Token::Add; ++pos_; break;
+                    case '-': type = Token::Sub; ++pos_; break;
+                    case '*': type = Token::Mul; ++pos_; break;
+                    case '/': type = Token::Div; ++pos_; break;
+                    case '(': type = Token::LeftParen; ++pos_; break;
+                    case ')': type = Token::RightParen; ++pos_; break;
+                    case ',': type = Token::Comma; ++pos_; break;
+                    case ':': type = Token::Colon; ++pos_; break;
+                    default:
+                        if (IsUpper(c)) {
+                            while (pos_ < text_.size() && IsUpper(text_[pos_])) {
+                                ++pos_;
+                            }
+                            size_t digits = pos_;
+                            pos_ = SkipDigits(pos_);
+                            // CELL: [A-Z]+[0-9]+, FUNCTION: [A-Z]+
+                            type = pos_ == digits ? Token::Function : Token::Cell;
+                        } else {
+                            pos_ = MatchNumber(begin);
+                            if (pos_ == begin) {
+                                throw ParsingError("Error when lexing: token recognition error at: '"
+                                                   + std::string(1, c) + "'");
+                            }
+                            type = Token::Number;
+                        }
+                }
+                token_ = {type, text_.substr(begin, pos_ - begin)};
+            }
+
+            // expr (ADD | SUB) expr
+            std::unique_ptr<Expr> ParseAdditive() {
+                auto lhs = ParseMultiplicative();
+                while (token_.type == Token::Add || token_.type == Token::Sub) {
+                    auto type = token_.type == Token::Add ? BinaryOpExpr::Add : BinaryOpExpr::Subtract;
+                    Advance();
+                    lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), ParseMultiplicative());
+                }
+                return lhs;
+            }
+
+            // expr (MUL | DIV) expr
+            std::unique_ptr<Expr> ParseMultiplicative() {
+                auto lhs = ParseUnary();
+                while (token_.type == Token::Mul || token_.type == Token::Div) {
+                    auto type = token_.type == Token::Mul ? BinaryOpExpr::Multiply : BinaryOpExpr::Divide;
+                    Advance();
+                    lhs = std::make_unique<BinaryOpExpr>(type, std::move(lhs), ParseUnary());
+                }
+                return lhs;
+            }
+
+            // (ADD | SUB) expr
+            std::unique_ptr<Expr> ParseUnary() {
+                if (token_.type == Token::Add || token_.type == Token::Sub) {
+                    auto type = token_.type == Token::Add ? UnaryOpExpr::UnaryPlus : UnaryOpExpr::UnaryMinus;
+                    Advance();
+                    return std::make_unique<UnaryOpExpr>(type, ParseUnary());
+                }
+                return ParseAtom();
+            }
+
+            // '(' expr ')' | FUNCTION '(' (arg (',' arg)*)? ')' | CELL | NUMBER
+            std::unique_ptr<Expr> ParseAtom() {
+                Token token = token_;
+                if (token.type == Token::LeftParen) {
+                    Advance();
+                    auto expr = ParseAdditive();
+                    if (token_.type != Token::RightParen) {
+                        throw ParsingError("Error when parsing: " + std::string(token_.text));
+                    }
+                    Advance();
+                    return expr;
+                }
+                if (token.type == Token::Function) {
+                    Advance();
+                    return ParseCall(token.text);
+                }
+                if (token.type == Token::Cell) {
+                    Advance();
+                    cells_.push_front(ToPosition(token.text));
+                    return std::make_unique<CellExpr>(&cells_.front());
+                }
+                if (token.type == Token::Number) {
+                    Advance();
+                    return std::make_unique<NumberExpr>(ParseNumber(token.text));
+                }
+                throw ParsingError("Error when parsing: " + std::string(token.text));
+            }
+
+            std::unique_ptr<Expr> ParseCall(std::string_view name) {
+                auto function = FindFunction(name);
+                if (!function) {
+                    throw ParsingError("Unknown function: " + std::string(name));
+                }
+
+                Expect(Token::LeftParen);
+                std::vector<std::unique_ptr<Expr>> args;
+                if (token_.type != Token::RightParen) {
+                    args.push_back(ParseArgument());
+                    while (token_.type == Token::Comma) {
+                        Advance();
+                        args.push_back(ParseArgument());
+                    }
+                }
+                Expect(Token::RightParen);
+                return std::make_unique<FunctionExpr>(*function, std::move(args));
+            }
+
+            // CELL ':' CELL | expr
+            std::unique_ptr<Expr> ParseArgument() {
+                if (token_.type == Token::Cell) {
+                    // one token of lookahead tells a range from an expression
+                    size_t pos = pos_;
+                    Token first = token_;
+                    Advance();
+                    if (token_.type == Token::Colon) {
+                        Advance();
+                        if (token_.type != Token::Cell) {
+                            throw ParsingError("Error when parsing: " + std::string(token_.text));
+                        }
+                        auto range = CellRange::FromCorners(ToPosition(first.text), ToPosition(token_.text));
+                        Advance();
+                        ranges_.push_back(range);
+                        return std::make_unique<RangeExpr>(range);
+                    }
+                    pos_ = pos;
+                    token_ = first;
+                }
+                return ParseAdditive();
+            }
+
+            void Expect(Token::Type type) {
+                if (token_.type != type) {
+                    throw ParsingError("Error when parsing: " + std::string(token_.text));
+                }
+                Advance();
+            }
+
+            static Position ToPosition(std::string_view text) {
+                auto value = Position::FromString(text);
+                if (!value.IsValid()) {
+                    throw FormulaException("Invalid position: " + std::string(text));
+                }
+                return value;
+            }
+
+            // same conversion as istream >> double in ParseASTListener
+            static double ParseNumber(std::string_view text) {
+                char buffer[64];
+                std::string long_text;
+                const char* str = buffer;
+                if (text.size() < sizeof(buffer)) {
+                    text.copy(buffer, text.size());
+                    buffer[text.size()] = '\0';
+                } else {
+                    long_text = std::string(text);
+                    str = long_text.c_str();
+                }
+                double value = std::strtod(str, nullptr);
+                if (std::isinf(value)) {
+                    throw ParsingError("Invalid number: " + std::string(text));
+                }
+                return value;
+            }
+
+            std::string_view text_;
+            size_t pos_ = 0;
+            Token token_;
+            std::forward_list<Position> cells_;
+            std::vector<CellRange> ranges_;
+        };
+
     }  // namespace
 }  // namespace ASTImpl
 
@@ -393,17 +799,19 @@ FormulaAST ParseFormulaAST(std::istream& in) {
     ASTImpl::ParseASTListener listener;
     tree::ParseTreeWalker::DEFAULT.walk(&listener, tree);
 
-    return FormulaAST(listener.MoveRoot(), listener.MoveCells());
+    return FormulaAST(listener.MoveRoot(), listener.MoveCells(), listener.MoveRanges());
 }
 
-FormulaAST ParseFormulaAST(const std::string& in_str) {
-    std::istringstream in(in_str);
-    return ParseFormulaAST(in);
+FormulaAST ParseFormulaAST(std::string_view in) {
+    ASTImpl::DescentParser parser(in);
+    auto root = parser.ParseMain();
+    return FormulaAST(std::move(root), parser.MoveCells(), parser.MoveRanges());
 }
 
 void FormulaAST::PrintCells(std::ostream& out) const {
     for (auto cell : cells_) {
-        out << cell.ToString() << ' ';
+        char buffer[Position::MAX_STRING_LENGTH];
+        out.write(buffer, cell.ToChars(buffer)) << ' ';
     }
 }
 
@@ -415,14 +823,206 @@ void FormulaAST::PrintFormula(std::ostream& out) const {
     root_expr_->PrintFormula(out, ASTImpl::EP_ATOM);
 }
 
-double FormulaAST::Execute([[maybe_unused]] std::function<double(Position)> function) const {
-    return root_expr_->Evaluate(std::move(function));
-}
+namespace ASTImpl {
+    namespace {
+        constexpr std::pair<std::string_view, Function> FUNCTIONS[] = {
+                {"SUM"sv, Function::Sum},
+                {"AVERAGE"sv, Function::Average},
+                {"MIN"sv, Function::Min},
+                {"MAX"sv, Function::Max},
+                {"COUNT"sv, Function::Count},
+        };
 
-FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells)
+        // Kernels keep several independent accumulators, which lets the compiler
+        // vectorize the loops without reassociating floating point operations
+        double Sum(const double* values, size_t size) {
+            double acc[4] = {0.0, 0.0, 0.0, 0.0};
+            size_t i = 0;
+            for (; i + 4 <= size; i += 4) {
+                acc[0] += values[i];
+                acc[1] += values[i + 1];
+                acc[2] += values[i + 2];
+                acc[3] += values[i + 3];
+            }
+            for (; i < size; ++i) {
+                acc[0] += values[i];
+            }
+            return (acc[0] + acc[1]) + (acc[2] + acc[3]);
+        }
+
+        template <typename Less>
+        double Extremum(const double* values, size_t size, Less less) {
+            if (size == 0) {
+                return 0.0;
+            }
+            double acc[4] = {values[0], values[0], values[0], values[0]};
+            size_t i = 0;
+            for (; i + 4 <= size; i += 4) {
+                for (size_t lane = 0; lane < 4; ++lane) {
+                    acc[lane] = less(values[i + lane], acc[lane]) ? values[i + lane] : acc[lane];
+                }
+            }
+            for (; i < size; ++i) {
+                acc[0] = less(values[i], acc[0]) ? values[i] : acc[0];
+            }
+            double result = acc[0];
+            for (size_t lane = 1; lane < 4; ++lane) {
+                result = less(acc[lane], result) ? acc[lane] : result;
+            }
+            return result;
+        }
+
+        FormulaInterface::Value Aggregate(Function function, const std::vector<double>& numbers) {
+            const double* values = numbers.data();
+            size_t size = numbers.size();
+            switch (function) {
+                case Function::Sum:
+                    return Sum(values, size);
+                case Function::Average:
+                    if (size == 0) {
+                        return FormulaError(FormulaError::Category::Div0);
+                    }
+                    return Sum(values, size) / static_cast<double>(size);
+                case Function::Min:
+                    return Extremum(values, size, std::less<double>{});
+                case Function::Max:
+                    return Extremum(values, size, std::greater<double>{});
+                case Function::Count:
+                    return static_cast<double>(size);
+            }
+            assert(false);
+            return 0.0;
+        }
+    }  // namespace
+
+    std::optional<Function> FindFunction(std::string_view name) {
+        for (const auto& [function_name, function] : FUNCTIONS) {
+            if (function_name == name) {
+                return function;
+            }
+        }
+        return std::nullopt;
+    }
+
+    std::string_view GetFunctionName(Function function) {
+        for (const auto& [function_name, known_function] : FUNCTIONS) {
+            if (known_function == function) {
+                return function_name;
+            }
+        }
+        assert(false);
+        return {};
+    }
+
+    size_t Program::CalculateStackSize() const {
+        size_t size = 0;
+        size_t max_size = 0;
+        for (const auto& instruction : code) {
+            switch (instruction.opcode) {
+                case Opcode::PushNumber:
+                case Opcode::PushCell:
+                    max_size = std::max(max_size, ++size);
+                    break;
+                case Opcode::Negate:
+                    break;
+                case Opcode::Call:
+                    size -= calls[instruction.operand].stack_args;
+                    max_size = std::max(max_size, ++size);
+                    break;
+                default:
+                    --size;
+            }
+        }
+        return max_size;
+    }
+}  // namespace ASTImpl
+
+FormulaAST::FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr, std::forward_list<Position> cells,
+                       std::vector<CellRange> ranges)
         : root_expr_(std::move(root_expr))
-        , cells_(std::move(cells)) {
+        , cells_(std::move(cells))
+        , ranges_(std::move(ranges)) {
     cells_.sort();  // to avoid sorting in GetReferencedCells
+    root_expr_->Compile(program_);
+    program_.stack_size = program_.CalculateStackSize();
+}
+
+FormulaInterface::Value FormulaAST::Execute(const FormulaInterface::CellLookup& lookup) const {
+    using ASTImpl::Opcode;
+
+    constexpr size_t INLINE_STACK_SIZE = 32;
+    double inline_stack[INLINE_STACK_SIZE];
+    std::unique_ptr<double[]> heap_stack;
+    double* stack = inline_stack;
+    if (program_.stack_size > INLINE_STACK_SIZE) {
+        heap_stack = std::make_unique<double[]>(program_.stack_size);
+        stack = heap_stack.get();
+    }
+
+    // arguments of function calls gathered into one contiguous block
+    std::vector<double> numbers;
+
+    const FormulaError div0(FormulaError::Category::Div0);
+
+    size_t top = 0;
+    for (const auto& instruction : program_.code) {
+        switch (instruction.opcode) {
+            case Opcode::PushNumber:
+                stack[top++] = program_.numbers[instruction.operand];
+                continue;
+            case Opcode::PushCell: {
+                FormulaInterface::Value value = lookup(program_.cells[instruction.operand]);
+                if (auto number = std::get_if<double>(&value)) {
+                    stack[top++] = *number;
+                    continue;
+                }
+                return value;
+            }
+            case Opcode::Negate:
+                stack[top - 1] = -stack[top - 1];
+                continue;
+            case Opcode::Add:
+                --top;
+                stack[top - 1] += stack[top];
+                break;
+            case Opcode::Subtract:
+                --top;
+                stack[top - 1] -= stack[top];
+                break;
+            case Opcode::Multiply:
+                --top;
+                stack[top - 1] *= stack[top];
+                break;
+            case Opcode::Divide:
+                --top;
+                if (stack[top] == 0 || std::isinf(stack[top])) {
+                    return div0;
+                }
+                stack[top - 1] /= stack[top];
+                break;
+            case Opcode::Call: {
+                const auto& call = program_.calls[instruction.operand];
+                top -= call.stack_args;
+                numbers.assign(stack + top, stack + top + call.stack_args);
+                for (uint32_t i = 0; i < call.range_count; ++i) {
+                    if (auto error = lookup.CollectNumbers(program_.ranges[call.first_range + i], numbers)) {
+                        return *error;
+                    }
+                }
+                auto result = ASTImpl::Aggregate(call.function, numbers);
+                if (auto number = std::get_if<double>(&result)) {
+                    stack[top++] = *number;
+                    break;
+                }
+                return result;
+            }
+        }
+        // result of an arithmetic operation
+        if (std::isinf(stack[top - 1])) {
+            return div0;
+        }
+    }
+    return stack[top - 1];
 }
 
-FormulaAST::~FormulaAST() = default;
\ No newline at end of file
+FormulaAST::~FormulaAST() = default;
@@ -2,13 +2,71 @@
 
 #include "FormulaLexer.h"
 #include "common.h"
+#include "formula.h"
 
+#include <cmath>
+#include <cstdint>
 #include <forward_list>
 #include <functional>
+#include <memory>
+#include <optional>
 #include <stdexcept>
+#include <string_view>
+#include <vector>
 
 namespace ASTImpl {
     class Expr;
+
+    enum class Opcode : uint8_t {
+        PushNumber,
+        PushCell,
+        Add,
+        Subtract,
+        Multiply,
+        Divide,
+        Negate,
+        Call,
+    };
+
+    enum class Function : uint8_t {
+        Sum,
+        Average,
+        Min,
+        Max,
+        Count,
+    };
+
+    // Function by its name in formulas, nullopt for unknown names
+    std::optional<Function> FindFunction(std::string_view name);
+    std::string_view GetFunctionName(Function function);
+
+    struct Instruction {
+        Opcode opcode;
+        // index in Program::numbers, Program::cells or Program::calls
+        uint32_t operand;
+    };
+
+    // Function call: values of expression arguments are on the top of the stack,
+    // range arguments are Program::ranges[first_range, first_range + range_count)
+    struct Call {
+        Function function;
+        uint32_t stack_args;
+        uint32_t first_range;
+        uint32_t range_count;
+    };
+
+    // Expression in postfix order: push instructions put operands on a stack,
+    // operations replace values on the top of the stack with their result
+    struct Program {
+        std::vector<Instruction> code;
+        std::vector<double> numbers;
+        std::vector<Position> cells;
+        std::vector<Call> calls;
+        std::vector<CellRange> ranges;
+        size_t stack_size = 0;
+
+        size_t CalculateStackSize() const;
+    };
 }
 
 class ParsingError : public std::runtime_error {
@@ -18,12 +76,14 @@ class ParsingError : public std::runtime_error {
 class FormulaAST {
 public:
     explicit FormulaAST(std::unique_ptr<ASTImpl::Expr> root_expr,
-                        std::forward_list<Position> cells);
+                        std::forward_list<Position> cells,
+                        std::vector<CellRange> ranges = {});
     FormulaAST(FormulaAST&&) = default;
     FormulaAST& operator=(FormulaAST&&) = default;
     ~FormulaAST();
 
-    double Execute(std::function<double(Position)> function) const;
+    // The first error met in referenced cells stops evaluation and becomes the result
+    FormulaInterface::Value Execute(const FormulaInterface::CellLookup& lookup) const;
     void PrintCells(std::ostream& out) const;
     void Print(std::ostream& out) const;
     void PrintFormula(std::ostream& out) const;
@@ -36,6 +96,11 @@ public:
         return cells_;
     }
 
+    // Range arguments of functions, in order of appearance
+    const std::vector<CellRange>& GetRanges() const {
+        return ranges_;
+    }
+
 private:
     std::unique_ptr<ASTImpl::Expr> root_expr_;
 
@@ -43,7 +108,15 @@ private:
     // efficiently traversed without going through
     // the whole AST
     std::forward_list<Position> cells_;
+    std::vector<CellRange> ranges_;
+
+    // root_expr_ lowered to a flat program at parse time, used for evaluation
+    ASTImpl::Program program_;
 };
 
+// Parses with the ANTLR generated parser, kept as the reference implementation
+// of Formula.g4
 FormulaAST ParseFormulaAST(std::istream& in);
-FormulaAST ParseFormulaAST(const std::string& in_str);
\ No newline at end of file
+// Parses with the hand-written recursive descent parser, builds the same AST as
+// the ANTLR one without creating streams, token lists or a parse tree
+FormulaAST ParseFormulaAST(std::string_view in);
\ No newline at end of file
@@ -0,0 +1,37 @@
+#include "bench_runner.h"
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+// Replaced global allocation functions counting calls. Array and nothrow forms
+// call these ones by default, over-aligned allocations are not counted
+namespace {
+    std::atomic<size_t> allocation_count{0};
+}  // namespace
+
+size_t GetAllocationCount() {
+    return allocation_count.load(std::memory_order_relaxed);
+}
+
+void* operator new(size_t size) {
+    allocation_count.fetch_add(1, std::memory_order_relaxed);
+    for (;;) {
+        if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+            return memory;
+        }
+        auto handler = std::get_new_handler();
+        if (handler == nullptr) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+void operator delete(void* memory) noexcept {
+    std::free(memory);
+}
+
+void operator delete(void* memory, size_t) noexcept {
+    std::free(memory);
+}
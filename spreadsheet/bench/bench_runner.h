@@ -0,0 +1,99 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Number of allocations made by all threads so far, counted by operator new
+// replaced for the benchmark executable in alloc_counter.cpp
+size_t GetAllocationCount();
+
+struct BenchResult {
+  std::string name;
+  long long operations = 0;
+  double ns_per_op = 0;
+  double allocations_per_op = 0;
+};
+
+// Runs a benchmark function until it took at least MIN_TIME and prints the
+// average time and number of allocations of one operation. The function returns
+// the number of operations it has done in one call. Only benchmarks with names
+// containing the filter are run, results are kept for SaveJson().
+class BenchRunner {
+public:
+  explicit BenchRunner(std::string filter = {})
+      : filter_(std::move(filter)) {
+  }
+
+  template <class BenchFunc>
+  void RunBench(BenchFunc func, const std::string& bench_name) {
+    using Clock = std::chrono::steady_clock;
+    if (bench_name.find(filter_) == std::string::npos) {
+      return;
+    }
+
+    long long operations = 0;
+    size_t allocations = 0;
+    Clock::duration elapsed{};
+    while (elapsed < MIN_TIME) {
+      size_t allocations_before = GetAllocationCount();
+      auto start = Clock::now();
+      operations += func();
+      elapsed += Clock::now() - start;
+      allocations += GetAllocationCount() - allocations_before;
+    }
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    BenchResult result{bench_name, operations, double(ns) / operations, double(allocations) / operations};
+    std::cerr << std::left << std::setw(48) << bench_name << ' ' << std::right
+              << std::setw(12) << std::fixed << std::setprecision(1)
+              << result.ns_per_op << " ns/op" << std::setw(12) << std::setprecision(2)
+              << result.allocations_per_op << " allocs/op" << std::endl;
+    results_.push_back(std::move(result));
+  }
+
+  const std::vector<BenchResult>& GetResults() const {
+    return results_;
+  }
+
+  // Writes results as {"benchmarks": [{"name": ..., "operations": ..., "ns_per_op": ...,
+  // "allocations_per_op": ...}, ...]}, one benchmark per line, so files of two
+  // commits can be compared line by line. Throws std::runtime_error if the file
+  // can't be written
+  void SaveJson(const std::string& path) const {
+    std::ofstream output(path);
+    output << "{\"benchmarks\": [\n" << std::setprecision(2) << std::fixed;
+    for (size_t i = 0; i < results_.size(); ++i) {
+      const auto& result = results_[i];
+      output << "  {\"name\": \"";
+      for (char c : result.name) {
+        if (c == '"' || c == '\\') {
+          output << '\\';
+        }
+        output << c;
+      }
+      output << "\", \"operations\": " << result.operations
+             << ", \"ns_per_op\": " << result.ns_per_op
+             << ", \"allocations_per_op\": " << result.allocations_per_op
+             << (i + 1 < results_.size() ? "},\n" : "}\n");
+    }
+    output << "]}\n";
+    if (!output.flush()) {
+      throw std::runtime_error("Can't write " + path);
+    }
+  }
+
+private:
+  static constexpr std::chrono::milliseconds MIN_TIME{300};
+
+  std::string filter_;
+  std::vector<BenchResult> results_;
+};
+
+#define RUN_BENCH(br, func) br.RunBench(func, #func)
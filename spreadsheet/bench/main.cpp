@@ -0,0 +1,723 @@
+#include "bench_runner.h"
+
+#include "common.h"
+#include "formula.h"
+#include "journal.h"
+#include "sheet.h"
+#include "sheet_io.h"
+#include "workloads.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace {
+    // A1 feeds a column of formulas, each of them is referenced by a total in C1.
+    // Changing A1 recalculates every formula in the sheet.
+    void FillFanSheet(Sheet& sheet, int size) {
+        sheet.SetCell(Position{0, 0}, "1");
+        std::string total = "=0";
+        for (int row = 0; row < size; ++row) {
+            Position pos{row, 1};
+            sheet.SetCell(pos, "=A1*" + std::to_string(row + 1) + "+1");
+            total += "+" + pos.ToString();
+        }
+        sheet.SetCell(Position{0, 2}, total);
+    }
+
+    constexpr int FAN_SIZE = 2000;
+
+    // A1 toggles between two numbers, all dependents get numbers
+    long long BenchRecalculateNumbers() {
+        static Sheet sheet;
+        static bool filled = (FillFanSheet(sheet, FAN_SIZE), true);
+        static bool flip = false;
+        (void)filled;
+
+        flip = !flip;
+        sheet.SetCell(Position{0, 0}, flip ? "2" : "3");
+        return FAN_SIZE + 1;
+    }
+
+    // Same with formulas of the fan calculated by 4 threads
+    long long BenchRecalculateNumbersParallel() {
+        static Sheet sheet;
+        static bool filled = (sheet.SetThreadCount(4), FillFanSheet(sheet, FAN_SIZE), true);
+        static bool flip = false;
+        (void)filled;
+
+        flip = !flip;
+        sheet.SetCell(Position{0, 0}, flip ? "2" : "3");
+        return FAN_SIZE + 1;
+    }
+
+    // A1 toggles between two errors, every dependent gets the error
+    long long BenchRecalculateErrors() {
+        static Sheet sheet;
+        static bool filled = (FillFanSheet(sheet, FAN_SIZE), true);
+        static bool flip = false;
+        (void)filled;
+
+        flip = !flip;
+        sheet.SetCell(Position{0, 0}, flip ? "=1/0" : "text");
+        return FAN_SIZE + 1;
+    }
+
+    // A column of numbers summed up in C1 either by a range or by a chain of additions,
+    // changing A1 recalculates the total only
+    void FillColumnTotal(Sheet& sheet, int size, bool use_range) {
+        std::string total = use_range ? "=SUM(A1:A" + std::to_string(size) + ")" : "=0";
+        for (int row = 0; row < size; ++row) {
+            Position pos{row, 0};
+            sheet.SetCell(pos, std::to_string(row % 10));
+            if (!use_range) {
+                total += "+" + pos.ToString();
+            }
+        }
+        sheet.SetCell(Position{0, 2}, total);
+    }
+
+    constexpr int COLUMN_SIZE = 4096;
+
+    long long BenchColumnTotalRange() {
+        static Sheet sheet;
+        static bool filled = (FillColumnTotal(sheet, COLUMN_SIZE, true), true);
+        static bool flip = false;
+        (void)filled;
+
+        flip = !flip;
+        sheet.SetCell(Position{0, 0}, flip ? "2" : "3");
+        return COLUMN_SIZE;
+    }
+
+    long long BenchColumnTotalAdditions() {
+        static Sheet sheet;
+        static bool filled = (FillColumnTotal(sheet, COLUMN_SIZE, false), true);
+        static bool flip = false;
+        (void)filled;
+
+        flip = !flip;
+        sheet.SetCell(Position{0, 0}, flip ? "2" : "3");
+        return COLUMN_SIZE;
+    }
+
+    // Model of 3 columns loaded from the last row up, so every formula is set
+    // before the cells it references: numbers, running totals and moving sums
+    std::vector<std::pair<Position, std::string>> MakeModelEdits(int rows) {
+        std::vector<std::pair<Position, std::string>> edits;
+        for (int row = rows - 1; row >= 0; --row) {
+            std::string r = std::to_string(row + 1);
+            edits.emplace_back(Position{row, 2}, "=SUM(A" + std::to_string(std::max(row - 8, 1)) + ":A" + r + ")");
+            edits.emplace_back(Position{row, 1}, row == 0 ? "=A1" : "=B" + std::to_string(row) + "+A" + r);
+            edits.emplace_back(Position{row, 0}, std::to_string(row % 100));
+        }
+        return edits;
+    }
+
+    constexpr int MODEL_ROWS = 2048;
+
+    long long BenchLoadModelSetCell() {
+        static const auto edits = MakeModelEdits(MODEL_ROWS);
+        Sheet sheet;
+        for (const auto& [pos, text] : edits) {
+            sheet.SetCell(pos, text);
+        }
+        return static_cast<long long>(edits.size());
+    }
+
+    long long BenchLoadModelSetCells() {
+        static const auto edits = MakeModelEdits(MODEL_ROWS);
+        Sheet sheet;
+        sheet.SetCells(edits);
+        return static_cast<long long>(edits.size());
+    }
+
+    // Texts of the model as written by PrintTexts(), imported by one and several threads
+    const std::string& GetModelTexts() {
+        static const std::string texts = [] {
+            Sheet sheet;
+            sheet.SetCells(MakeModelEdits(MODEL_ROWS));
+            std::ostringstream output;
+            sheet.PrintTexts(output);
+            return output.str();
+        }();
+        return texts;
+    }
+
+    long long BenchImportModel() {
+        Sheet sheet;
+        ImportTexts(sheet, GetModelTexts());
+        return MODEL_ROWS * 3;
+    }
+
+    long long BenchImportModelParallel() {
+        Sheet sheet;
+        sheet.SetThreadCount(4);
+        ImportTexts(sheet, GetModelTexts());
+        return MODEL_ROWS * 3;
+    }
+
+    // Model of the maximal number of rows printed as values, per printed cell
+    void RunPrintModel(BenchRunner& br, const std::string& name, size_t threads) {
+        Sheet sheet;
+        sheet.SetThreadCount(threads);
+        sheet.SetCells(MakeModelEdits(Position::MAX_ROWS));
+        std::ostringstream output;
+        br.RunBench([&sheet, &output] {
+            output.str({});
+            sheet.PrintValues(output);
+            return Position::MAX_ROWS * 3LL;
+        }, name);
+    }
+
+    // Model of the maximal number of rows saved to a snapshot and loaded back,
+    // compared with importing its texts
+    void RunSnapshotModel(BenchRunner& br) {
+        Sheet sheet;
+        sheet.SetCells(MakeModelEdits(Position::MAX_ROWS));
+        const long long cell_count = Position::MAX_ROWS * 3LL;
+
+        std::ostringstream snapshot;
+        br.RunBench([&sheet, &snapshot, cell_count] {
+            snapshot.str({});
+            sheet.SaveSnapshot(snapshot);
+            return cell_count;
+        }, "SaveModelSnapshot");
+
+        const std::string data = snapshot.str();
+        br.RunBench([&data, cell_count] {
+            Sheet loaded;
+            loaded.LoadSnapshot(data);
+            return cell_count;
+        }, "LoadModelSnapshot");
+
+        std::ostringstream texts;
+        sheet.PrintTexts(texts);
+        br.RunBench([texts = texts.str(), cell_count] {
+            Sheet imported;
+            ImportTexts(imported, texts);
+            return cell_count;
+        }, "ImportModelTexts");
+    }
+
+    // Edits of numbers and formulas over a 256x256 area logged to a journal with
+    // group commit and with an fsync per edit, then replayed
+    void RunJournal(BenchRunner& br) {
+        const auto path = (std::filesystem::temp_directory_path() / "spreadsheet_bench.journal").string();
+        auto run_edits = [&br](const std::string& name, EditJournal* journal) {
+            Sheet sheet;
+            sheet.SetJournal(journal);
+            int i = 0;
+            br.RunBench([&sheet, &i] {
+                for (int j = 0; j < 256; ++j, ++i) {
+                    Position pos{(i * 7) % 256, 1 + i % 255};
+                    sheet.SetCell(pos, i % 3 == 0 ? "=" + Position{pos.row, 0}.ToString() + "+1" : std::to_string(i));
+                }
+                return 256LL;
+            }, name);
+        };
+
+        run_edits("EditsWithoutJournal", nullptr);
+        std::filesystem::remove(path);
+        {
+            EditJournal journal(path);
+            run_edits("EditsWithGroupCommit", &journal);
+        }
+        std::filesystem::remove(path);
+        {
+            EditJournal journal(path, JournalOptions{1, std::chrono::milliseconds(0)});
+            run_edits("EditsWithCommitPerEdit", &journal);
+        }
+
+        std::filesystem::remove(path);
+        {
+            EditJournal journal(path);
+            for (int i = 0; i < 65536; ++i) {
+                journal.LogSet(Position{i % 4096, (i * 13) % 64}, i % 2 ? "=A1+" + std::to_string(i) : std::to_string(i));
+            }
+        }
+        br.RunBench([&path] {
+            Sheet sheet;
+            return static_cast<long long>(ReplayJournal(sheet, path));
+        }, "ReplayJournal");
+        std::filesystem::remove(path);
+    }
+
+    // 1024x64 numbers with a total per row in column BM
+    void FillGridSheet(Sheet& sheet) {
+        sheet.SetCells(MakeGridWorkload(1024, 64).edits);
+    }
+
+    void RunViews(BenchRunner& br) {
+        Sheet sheet;
+        FillGridSheet(sheet);
+        br.RunBench([&sheet] {
+            for (int i = 0; i < 256; ++i) {
+                auto view = sheet.CreateView();
+            }
+            return 256LL;
+        }, "CreateView");
+
+        // every edit after a view copies the tile it changes
+        int i = 0;
+        br.RunBench([&sheet, &i] {
+            for (int j = 0; j < 256; ++j, ++i) {
+                auto view = sheet.CreateView();
+                sheet.SetCell(Position{(i * 7) % 1024, i % 64}, std::to_string(i));
+            }
+            return 256LL;
+        }, "EditAfterCreateView");
+
+        // two readers print the latest view published every 64 edits
+        std::mutex mutex;
+        auto published = std::make_shared<const SheetView>(sheet.CreateView());
+        std::atomic<bool> done = false;
+        std::vector<std::thread> readers;
+        for (int reader = 0; reader < 2; ++reader) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    std::shared_ptr<const SheetView> view;
+                    {
+                        std::lock_guard lock(mutex);
+                        view = published;
+                    }
+                    std::ostringstream output;
+                    view->PrintValues(output);
+                }
+            });
+        }
+        br.RunBench([&] {
+            for (int j = 0; j < 256; ++j, ++i) {
+                sheet.SetCell(Position{(i * 7) % 1024, i % 64}, std::to_string(i));
+                if (j % 64 == 63) {
+                    auto view = std::make_shared<const SheetView>(sheet.CreateView());
+                    std::lock_guard lock(mutex);
+                    published = std::move(view);
+                }
+            }
+            return 256LL;
+        }, "EditsWithViewReaders");
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+    }
+
+    // Reads of row totals by threads taking the published view for every read,
+    // optionally while the writer keeps changing numbers
+    void RunConcurrentReads(BenchRunner& br) {
+        constexpr int READS = 1 << 14;
+        Sheet sheet;
+        FillGridSheet(sheet);
+        auto read_totals = [&sheet](int seed) {
+            double sum = 0;
+            for (int i = 0; i < READS; ++i) {
+                auto view = sheet.GetPublishedView();
+                sum += std::get<double>(view->GetCell(Position{(seed + i * 7) % 1024, 64})->GetValue());
+            }
+            return sum;
+        };
+
+        double total = 0;
+        br.RunBench([&sheet, &total] {
+            for (int i = 0; i < READS; ++i) {
+                total += std::get<double>(sheet.GetCell(Position{(i * 7) % 1024, 64})->GetValue());
+            }
+            return static_cast<long long>(READS);
+        }, "ReadsFromSheet");
+
+        sheet.SetConcurrentReads(true);
+        for (size_t threads : {1, 4}) {
+            for (bool with_writer : {false, true}) {
+                int edit = 0;
+                br.RunBench([&] {
+                    std::atomic<int> running = static_cast<int>(threads);
+                    std::vector<std::thread> readers;
+                    for (size_t thread = 0; thread < threads; ++thread) {
+                        readers.emplace_back([&, thread] {
+                            read_totals(static_cast<int>(thread));
+                            --running;
+                        });
+                    }
+                    while (with_writer && running > 0) {
+                        sheet.SetCell(Position{(edit * 7) % 1024, edit % 64}, std::to_string(edit));
+                        ++edit;
+                    }
+                    for (auto& reader : readers) {
+                        reader.join();
+                    }
+                    return static_cast<long long>(READS * threads);
+                }, std::string(with_writer ? "PublishedReadsWithWriter" : "PublishedReads")
+                           + "/threads:" + std::to_string(threads));
+            }
+        }
+        sheet.SetConcurrentReads(false);
+        (void)total;
+    }
+
+    // A1 feeds 4096 formulas each multiplying it by a number stored as text, and a
+    // total summing all of the texts. Changing A1 reads every text twice
+    long long BenchRecalculateTextNumbers() {
+        constexpr int ROWS = 4096;
+        static Sheet sheet;
+        static bool filled = [] {
+            std::vector<std::pair<Position, std::string>> edits{{Position{0, 0}, "1"}};
+            for (int row = 0; row < ROWS; ++row) {
+                edits.emplace_back(Position{row, 2}, std::to_string(row) + ".25");
+                edits.emplace_back(Position{row, 1}, "=A1*" + Position{row, 2}.ToString());
+            }
+            edits.emplace_back(Position{0, 3}, "=A1+SUM(C1:C" + std::to_string(ROWS) + ")");
+            sheet.SetCells(std::move(edits));
+            return true;
+        }();
+        static bool flip = false;
+        (void)filled;
+
+        flip = !flip;
+        sheet.SetCell(Position{0, 0}, flip ? "2" : "3");
+        return 2 * ROWS;
+    }
+
+    // 98304 formulas reference A1, one of them is changed back and forth. The edit
+    // moves a reference out of and into the bucket of A1 shared by all of them
+    void RunEditDependentOfHotCell(BenchRunner& br) {
+        constexpr int COLS = 6;
+        Sheet sheet;
+        std::vector<std::pair<Position, std::string>> edits{{Position{0, 0}, "1"}};
+        for (int row = 0; row < Position::MAX_ROWS; ++row) {
+            for (int col = 1; col <= COLS; ++col) {
+                edits.emplace_back(Position{row, col}, "=A1+" + std::to_string(row));
+            }
+        }
+        sheet.SetCells(std::move(edits));
+
+        int edit = 0;
+        br.RunBench([&sheet, &edit] {
+            for (int i = 0; i < 256; ++i) {
+                ++edit;
+                Position pos{(edit * 7) % Position::MAX_ROWS, 1 + edit % COLS};
+                sheet.SetCell(pos, "=A1*" + std::to_string(edit % 3));
+            }
+            return 256LL;
+        }, "EditDependentOfHotCell");
+    }
+
+    // Columns of 16384 texts cleared from the bottom cell by cell or at once. Sheets are
+    // filled in the timed function as well, the fill alone is measured for reference
+    void RunClearColumns(BenchRunner& br) {
+        constexpr int COLS = 4;
+        auto fill = [](Sheet& sheet) {
+            std::vector<std::pair<Position, std::string>> edits;
+            for (int row = 0; row < Position::MAX_ROWS; ++row) {
+                for (int col = 0; col < COLS; ++col) {
+                    edits.emplace_back(Position{row, col}, "x");
+                }
+            }
+            sheet.SetCells(std::move(edits));
+        };
+        constexpr long long CELLS = static_cast<long long>(Position::MAX_ROWS) * COLS;
+
+        br.RunBench([&fill] {
+            Sheet sheet;
+            fill(sheet);
+            return CELLS;
+        }, "FillColumns");
+        br.RunBench([&fill] {
+            Sheet sheet;
+            fill(sheet);
+            for (int row = Position::MAX_ROWS - 1; row >= 0; --row) {
+                for (int col = 0; col < COLS; ++col) {
+                    sheet.ClearCell(Position{row, col});
+                }
+            }
+            return CELLS;
+        }, "FillAndClearCells");
+        br.RunBench([&fill] {
+            Sheet sheet;
+            fill(sheet);
+            sheet.ClearRange(CellRange{{0, 0}, {Position::MAX_ROWS - 1, COLS - 1}});
+            return CELLS;
+        }, "FillAndClearRange");
+    }
+
+    // Conversions as they were before ToChars(), for reference
+    Position LegacyFromString(std::string_view str) {
+        auto it = std::find_if(str.begin(), str.end(), [](const char c) {
+            return !(std::isalpha(c) && std::isupper(c));
+        });
+        auto letters = str.substr(0, it - str.begin());
+        auto digits = str.substr(it - str.begin());
+        if (letters.empty() || digits.empty() || letters.size() > 3 || !std::isdigit(digits[0])) {
+            return Position::NONE;
+        }
+        int row;
+        std::istringstream row_in{std::string{digits}};
+        if (!(row_in >> row) || !row_in.eof()) {
+            return Position::NONE;
+        }
+        int col = 0;
+        for (char ch : letters) {
+            col = col * 26 + ch - 'A' + 1;
+        }
+        return {row - 1, col - 1};
+    }
+
+    std::string LegacyToString(Position pos) {
+        if (!pos.IsValid()) {
+            return "";
+        }
+        std::string result;
+        result.reserve(17);
+        for (int c = pos.col; c >= 0; c = c / 26 - 1) {
+            result.insert(result.begin(), 'A' + c % 26);
+        }
+        return result + std::to_string(pos.row + 1);
+    }
+
+    // 4096 positions spread over the sheet, converted back and forth
+    void RunPositionConversion(BenchRunner& br) {
+        std::vector<Position> positions;
+        std::vector<std::string> names;
+        for (int i = 0; i < 4096; ++i) {
+            Position pos{(i * 7919) % Position::MAX_ROWS, (i * 104729) % Position::MAX_COLS};
+            positions.push_back(pos);
+            names.push_back(pos.ToString());
+        }
+        const long long count = positions.size();
+
+        int sink = 0;
+        br.RunBench([&] {
+            for (const auto& name : names) {
+                sink += LegacyFromString(name).row;
+            }
+            return count;
+        }, "PositionFromString/legacy");
+        br.RunBench([&] {
+            for (const auto& name : names) {
+                sink += Position::FromString(name).row;
+            }
+            return count;
+        }, "PositionFromString");
+        br.RunBench([&] {
+            for (auto pos : positions) {
+                sink += static_cast<int>(LegacyToString(pos).size());
+            }
+            return count;
+        }, "PositionToString/legacy");
+        br.RunBench([&] {
+            for (auto pos : positions) {
+                sink += static_cast<int>(pos.ToString().size());
+            }
+            return count;
+        }, "PositionToString");
+        br.RunBench([&] {
+            char buffer[Position::MAX_STRING_LENGTH];
+            for (auto pos : positions) {
+                sink += static_cast<int>(pos.ToChars(buffer));
+            }
+            return count;
+        }, "PositionToChars");
+
+        // formulas of 4 cells parsed and printed, as by SetCell() and GetText()
+        std::vector<std::string> expressions;
+        for (size_t i = 0; i + 4 <= names.size(); i += 4) {
+            expressions.push_back(names[i] + "+" + names[i + 1] + "*" + names[i + 2] + "-" + names[i + 3]);
+        }
+        const long long formula_count = expressions.size();
+        br.RunBench([&] {
+            for (const auto& expression : expressions) {
+                sink += static_cast<int>(ParseFormula(expression)->GetExpression().size());
+            }
+            return formula_count;
+        }, "ParseAndPrintFormulaOfCells");
+        if (sink == 42) {
+            std::cerr << sink << std::endl;
+        }
+    }
+
+    // Operations on a synthetic sheet, each of them named <workload>/<operation>
+    void RunWorkload(BenchRunner& br, const Workload& workload) {
+        const std::string& name = workload.name;
+        const long long cell_count = workload.edits.size();
+
+        std::vector<std::string> expressions;
+        for (const auto& [pos, text] : workload.edits) {
+            if (text.size() > 1 && text[0] == FORMULA_SIGN) {
+                expressions.push_back(text.substr(1));
+            }
+        }
+        br.RunBench([&expressions] {
+            for (const auto& expression : expressions) {
+                ParseFormula(expression);
+            }
+            return static_cast<long long>(expressions.size());
+        }, name + "/Parse");
+
+        br.RunBench([&workload, cell_count] {
+            Sheet sheet;
+            sheet.SetCells(workload.edits);
+            return cell_count;
+        }, name + "/LoadBySetCells");
+        br.RunBench([&workload, cell_count] {
+            Sheet sheet;
+            for (const auto& [pos, text] : workload.edits) {
+                sheet.SetCell(pos, text);
+            }
+            return cell_count;
+        }, name + "/LoadBySetCell");
+
+        // changes of the source recalculating its dependents at once, or only those
+        // the sink needs when it's read
+        Sheet sheet;
+        sheet.SetCells(workload.edits);
+        int edit = 0;
+        br.RunBench([&] {
+            sheet.SetCell(workload.source, std::to_string(++edit % 7));
+            return 1LL;
+        }, name + "/SetCell");
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        br.RunBench([&] {
+            sheet.SetCell(workload.source, std::to_string(++edit % 7));
+            sheet.GetCell(workload.sink)->GetValue();
+            return 1LL;
+        }, name + "/Evaluate");
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Eager);
+
+        const std::string sink_text = sheet.GetCell(workload.sink)->GetText();
+        br.RunBench([&] {
+            sheet.ClearCell(workload.sink);
+            sheet.SetCell(workload.sink, sink_text);
+            return 1LL;
+        }, name + "/ClearAndSetCell");
+
+        // the source referencing the sink is rejected, the sheet stays as it is
+        const std::string cycle = "=" + workload.sink.ToString();
+        br.RunBench([&] {
+            try {
+                sheet.SetCell(workload.source, cycle);
+            } catch (const CircularDependencyException&) {
+            }
+            return 1LL;
+        }, name + "/CycleCheck");
+
+        if (workload.is_printable) {
+            const auto size = sheet.GetPrintableSize();
+            std::ostringstream output;
+            br.RunBench([&] {
+                output.str({});
+                sheet.PrintValues(output);
+                return static_cast<long long>(size.rows) * size.cols;
+            }, name + "/PrintValues");
+        }
+    }
+
+    void RunWorkloads(BenchRunner& br) {
+        constexpr uint32_t SEED = 2024;
+        for (const auto& workload : {MakeChainWorkload(4096), MakeFanOutWorkload(4096), MakeFanInWorkload(2048),
+                                     MakeRandomDagWorkload(8192, SEED), MakeErrorWorkload(4096, SEED),
+                                     MakeSparseWideWorkload(4096, SEED), MakeGridWorkload(1024, 64)}) {
+            RunWorkload(br, workload);
+        }
+    }
+
+    // Sheets of 4096 formulas fed by A1 for scaling of parallel recalculation
+
+    // B1 = A1 + 1, B2 = B1 + 1, ...: no parallelism at all
+    void FillChainSheet(Sheet& sheet) {
+        sheet.SetCells(MakeChainWorkload(4096).edits);
+    }
+
+    void FillWideFanSheet(Sheet& sheet) {
+        FillFanSheet(sheet, 4095);
+    }
+
+    // 64x64 grid, every cell is the average of the cells above and to the left,
+    // so the parallelism grows and shrinks along the diagonals
+    void FillLatticeSheet(Sheet& sheet) {
+        sheet.SetCell(Position{0, 0}, "1");
+        for (int row = 0; row < 64; ++row) {
+            for (int col = 1; col <= 64; ++col) {
+                std::string up = row == 0 ? "A1" : Position{row - 1, col}.ToString();
+                std::string left = col == 1 ? "A1" : Position{row, col - 1}.ToString();
+                sheet.SetCell(Position{row, col}, "=(" + up + "+" + left + ")/2");
+            }
+        }
+    }
+
+    void RunScaling(BenchRunner& br, const std::string& name, void (*fill)(Sheet&)) {
+        const size_t max_threads = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t threads = 1;; threads = std::min(threads * 2, max_threads)) {
+            Sheet sheet;
+            sheet.SetThreadCount(threads);
+            fill(sheet);
+            bool flip = false;
+            br.RunBench([&sheet, &flip] {
+                flip = !flip;
+                sheet.SetCell(Position{0, 0}, flip ? "2" : "3");
+                return 4096LL;
+            }, name + "/threads:" + std::to_string(threads));
+
+            if (threads == max_threads) {
+                break;
+            }
+        }
+    }
+}  // namespace
+
+// Usage: spreadsheet_bench [--filter <substring of names>] [--json <path>]
+int main(int argc, char* argv[]) {
+    std::string filter;
+    std::string json_path;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view arg = argv[i];
+        if (arg == "--filter" && i + 1 < argc) {
+            filter = argv[++i];
+        } else if (arg == "--json" && i + 1 < argc) {
+            json_path = argv[++i];
+        } else {
+            std::cerr << "Usage: " << argv[0] << " [--filter <substring of names>] [--json <path>]" << std::endl;
+            return 1;
+        }
+    }
+
+    BenchRunner br(filter);
+    RUN_BENCH(br, BenchRecalculateNumbers);
+    RUN_BENCH(br, BenchRecalculateNumbersParallel);
+    RUN_BENCH(br, BenchRecalculateErrors);
+    RUN_BENCH(br, BenchColumnTotalRange);
+    RUN_BENCH(br, BenchColumnTotalAdditions);
+    RUN_BENCH(br, BenchRecalculateTextNumbers);
+    RUN_BENCH(br, BenchLoadModelSetCell);
+    RUN_BENCH(br, BenchLoadModelSetCells);
+    RUN_BENCH(br, BenchImportModel);
+    RUN_BENCH(br, BenchImportModelParallel);
+    RunPrintModel(br, "PrintModelValues", 1);
+    RunPrintModel(br, "PrintModelValuesParallel", 4);
+    RunSnapshotModel(br);
+    RunJournal(br);
+    RunViews(br);
+    RunConcurrentReads(br);
+    RunClearColumns(br);
+    RunEditDependentOfHotCell(br);
+    RunPositionConversion(br);
+
+    RunScaling(br, "ScalingChain", FillChainSheet);
+    RunScaling(br, "ScalingFan", FillWideFanSheet);
+    RunScaling(br, "ScalingLattice", FillLatticeSheet);
+    RunWorkloads(br);
+
+    if (!json_path.empty()) {
+        br.SaveJson(json_path);
+    }
+    return 0;
+}
@@ -0,0 +1,138 @@
+#include "workloads.h"
+
+#include <random>
+#include <unordered_set>
+
+// Random numbers are taken from mt19937 directly, distributions of the standard
+// library differ between implementations
+
+Workload MakeChainWorkload(int length) {
+    Workload workload{"Chain", {{Position{0, 0}, "1"}}, Position{0, 0}, Position{length - 1, 1}};
+    workload.edits.emplace_back(Position{0, 1}, "=A1+1");
+    for (int row = 1; row < length; ++row) {
+        workload.edits.emplace_back(Position{row, 1}, "=" + Position{row - 1, 1}.ToString() + "+1");
+    }
+    return workload;
+}
+
+Workload MakeFanOutWorkload(int size) {
+    Workload workload{"FanOut", {{Position{0, 0}, "1"}}, Position{0, 0}, Position{size - 1, 1}};
+    for (int row = 0; row < size; ++row) {
+        workload.edits.emplace_back(Position{row, 1}, "=A1*" + std::to_string(row + 1));
+    }
+    return workload;
+}
+
+Workload MakeFanInWorkload(int size) {
+    Workload workload{"FanIn", {}, Position{0, 0}, Position{0, 2}};
+    std::string total = "=A1";
+    workload.edits.emplace_back(Position{0, 0}, "1");
+    for (int row = 1; row < size; ++row) {
+        workload.edits.emplace_back(Position{row, 0}, std::to_string(row % 10));
+        total += "+" + Position{row, 0}.ToString();
+    }
+    workload.edits.emplace_back(Position{0, 2}, std::move(total));
+    return workload;
+}
+
+Workload MakeRandomDagWorkload(int size, uint32_t seed) {
+    constexpr int COLS = 64;
+    auto to_position = [](int index) {
+        return Position{index / COLS, index % COLS};
+    };
+
+    Workload workload{"RandomDag", {{Position{0, 0}, "1"}, {Position{0, 1}, "=A1+1"}},
+                      Position{0, 0}, Position{0, 1}};
+    // whether the cell of the index depends on source
+    std::vector<bool> depends{false, true};
+    std::mt19937 random(seed);
+    for (int index = 2; index < size; ++index) {
+        Position pos = to_position(index);
+        std::string text;
+        bool is_dependent = false;
+        uint32_t kind = random() % 4;
+        if (kind == 0) {
+            text = std::to_string(random() % 1000);
+        } else if (kind == 3 && pos.row > 0) {
+            int first_row = static_cast<int>(random() % pos.row);
+            text = "=SUM(" + Position{first_row, pos.col}.ToString() + ":" + Position{pos.row - 1, pos.col}.ToString() + ")";
+            for (int row = first_row; row < pos.row; ++row) {
+                is_dependent = is_dependent || depends[row * COLS + pos.col];
+            }
+        } else {
+            text = "=";
+            int count = 1 + static_cast<int>(random() % 3);
+            for (int i = 0; i < count; ++i) {
+                int referenced = static_cast<int>(random() % index);
+                text += (i == 0 ? "" : i == 1 ? "+" : "*") + to_position(referenced).ToString();
+                is_dependent = is_dependent || depends[referenced];
+            }
+        }
+        workload.edits.emplace_back(pos, std::move(text));
+        depends.push_back(is_dependent);
+        if (is_dependent) {
+            workload.sink = pos;
+        }
+    }
+    return workload;
+}
+
+Workload MakeErrorWorkload(int size, uint32_t seed) {
+    Workload workload{"Errors", {{Position{0, 0}, "1"}}, Position{0, 0}, Position{0, 0}};
+    std::mt19937 random(seed);
+    for (int row = 1; row < size; ++row) {
+        const std::string a = Position{row, 0}.ToString();
+        const std::string b = Position{row, 1}.ToString();
+        switch (random() % 3) {
+            case 0:
+                workload.edits.emplace_back(Position{row, 0}, "x");
+                break;
+            case 1:
+                workload.edits.emplace_back(Position{row, 0}, "=1/0");
+                break;
+            default:
+                workload.edits.emplace_back(Position{row, 0}, std::to_string(row));
+                break;
+        }
+        workload.edits.emplace_back(Position{row, 1}, "=A1+" + a);
+        workload.edits.emplace_back(Position{row, 2}, "=" + b + "/" + std::to_string(row % 3));
+    }
+    workload.sink = Position{size - 1, 2};
+    return workload;
+}
+
+Workload MakeSparseWideWorkload(int size, uint32_t seed) {
+    Workload workload{"SparseWide", {{Position{0, 0}, "1"}}, Position{0, 0}, Position{0, 0}};
+    workload.is_printable = false;
+    std::unordered_set<Position, PositionHasher> used{Position{0, 0}};
+    std::mt19937 random(seed);
+    while (static_cast<int>(workload.edits.size()) < size) {
+        Position pos{static_cast<int>(random() % Position::MAX_ROWS),
+                     static_cast<int>(random() % Position::MAX_COLS)};
+        if (!used.insert(pos).second) {
+            continue;
+        }
+        if (random() % 2 == 0) {
+            workload.edits.emplace_back(pos, std::to_string(random() % 1000));
+        } else {
+            Position referenced = workload.edits[random() % workload.edits.size()].first;
+            workload.edits.emplace_back(pos, "=A1+" + referenced.ToString());
+            workload.sink = pos;
+        }
+    }
+    return workload;
+}
+
+Workload MakeGridWorkload(int rows, int cols) {
+    Workload workload{"Grid", {}, Position{0, 0}, Position{0, cols}};
+    const std::string last_col = Position{0, cols - 1}.ToString();
+    const std::string last_letters = last_col.substr(0, last_col.size() - 1);
+    for (int row = 0; row < rows; ++row) {
+        for (int col = 0; col < cols; ++col) {
+            workload.edits.emplace_back(Position{row, col}, std::to_string(row + col));
+        }
+        const std::string r = std::to_string(row + 1);
+        workload.edits.emplace_back(Position{row, cols}, "=SUM(A" + r + ":" + last_letters + r + ")");
+    }
+    return workload;
+}
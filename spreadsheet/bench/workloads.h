@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Synthetic sheet for benchmarks. Generators return the same workload for the
+// same arguments on every machine, so results of two commits are comparable
+struct Workload {
+    std::string name;
+    // texts of cells, loading them in this order sets no formula before the cells
+    // it references
+    std::vector<std::pair<Position, std::string>> edits;
+    // number feeding the formulas, changed to recalculate them
+    Position source;
+    // formula depending on source, referencing it from source closes a cycle
+    Position sink;
+    // small enough to be printed as a whole
+    bool is_printable = true;
+};
+
+// B1 = A1 + 1, B2 = B1 + 1, ... down to B<length>
+Workload MakeChainWorkload(int length);
+// A1 feeds size formulas of column B
+Workload MakeFanOutWorkload(int size);
+// C1 adds up size numbers of column A one by one
+Workload MakeFanInWorkload(int size);
+// Cells of a grid 64 columns wide in row-major order, a quarter of them numbers,
+// the rest formulas of 1 to 3 random cells set before them or a range above them
+Workload MakeRandomDagWorkload(int size, uint32_t seed);
+// Column A of numbers, texts and divisions by zero; B adds A1 to them and C divides
+// B by 0, 1 or 2, so most formulas are errors
+Workload MakeErrorWorkload(int size, uint32_t seed);
+// Cells scattered over the whole sheet, half of them formulas of A1 and a random
+// cell set before them
+Workload MakeSparseWideWorkload(int size, uint32_t seed);
+// rows x cols numbers with a SUM of every row after them
+Workload MakeGridWorkload(int rows, int cols);
@@ -1,39 +1,26 @@
 #include "cell.h"
+#include "sheet.h"
+#include "storage.h"
 
 #include <cassert>
 #include <iostream>
 #include <memory>
 #include <string>
-#include <optional>
+#include <string_view>
 
 
-std::unique_ptr<Impl> ParseCellContent(std::string text, SheetInterface* sheet) {
-
-    if (!text.empty() && text[0] == '=' && text != "=") { // Check expression
-        return std::make_unique<FormulaImpl>(text, sheet);
-    }
-
-    if (!text.empty()) { // Check expression
-        return std::make_unique<TextImpl>(text);
-    }
-
-    return std::make_unique<EmptyImpl>();
-}
-
 // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
 // формулы
 using Value = std::variant<std::string, double, FormulaError>;
 
-// Реализуйте следующие методы
-Cell::Cell(SheetInterface& sheet)
-        : sheet_(&sheet)
-{
-}
+// records fill the chunks of CellStorage, see CellStorage::CHUNK_SIZE
+static_assert(sizeof(void*) != 8 || sizeof(Cell) <= 40, "Cell record outgrew 40 bytes");
 
+// Реализуйте следующие методы
 Cell::~Cell() {
 }
 
-void Cell::Set(std::string text) {
+void Cell::Set(std::string text, std::shared_ptr<const FormulaInterface> formula) {
 // Задаёт содержимое ячейки. Если текст начинается со знака "=", то он
     // интерпретируется как формула. Уточнения по записи формулы:
     // * Если текст содержит только символ "=" и больше ничего, то он не считается
@@ -43,126 +30,259 @@ void Cell::Set(std::string text) {
     // начать текст со знака "=", но чтобы он не интерпретировался как формула.
 
     if (!text.empty() && text[0] == '=' && text != "=") { // Check expression
-        impl_ = std::make_unique<FormulaImpl>(text, sheet_);
+        if (formula == nullptr) {
+            formula = ParseFormula(text.substr(1));
+        }
+        SetFormula(std::move(formula));
         return;
     }
 
     if (!text.empty()) { // Check expression
-        impl_ = std::make_unique<TextImpl>(text);
+        content_ = std::make_shared<const std::string>(std::move(text));
+        kind_ = Kind::Text;
+        // formulas read the text as a number, so it's parsed once here
+        SetCache(TextToNumber(GetVisibleText()));
         return;
     }
 
-    impl_ = std::make_unique<EmptyImpl>();
+    Clear();
 
 }
 
-void Cell::AddDependency(Position pos) {
-    auto it = std::find(depends_from_this_.begin(), depends_from_this_.end(), pos);
-    if (it == depends_from_this_.end()) {
-        depends_from_this_.push_back(pos);
-    }
+void Cell::SetFormula(std::shared_ptr<const FormulaInterface> formula) {
+    content_ = std::move(formula);
+    kind_ = Kind::Formula;
+    cache_state_ = CacheState::Dirty;
 }
 
-void Cell::DeleteDependency(Position pos) {
-    auto it = std::find(depends_from_this_.begin(), depends_from_this_.end(), pos);
-    if (it != depends_from_this_.end()) {
-        depends_from_this_.erase(it);
+const std::vector<CellRange>& Cell::GetReferencedRanges() const {
+    if (auto formula = GetFormula()) {
+        return formula->GetReferencedRanges();
     }
+    static const std::vector<CellRange> no_ranges;
+    return no_ranges;
 }
 
-void Cell::RecursiveRecalculateValueCycle() {
-    for (const auto& cell : depends_from_this_) {
-        auto ptr = dynamic_cast<Cell*>(sheet_->GetCell(cell));
-        ptr->RecursiveRecalculateValue();
-    }
+int Cell::GetOrder() const {
+    return order_;
 }
 
-void Cell::RecursiveRecalculateValue() {
+void Cell::SetOrder(int order) {
+    order_ = order;
+}
 
-    impl_->CalculateValue();
-    RecursiveRecalculateValueCycle();
+void Cell::Recalculate(const Sheet& sheet) {
+    CalculateValue(sheet);
 }
 
+void Cell::InvalidateCache() {
+    // the number of a text cell stays
+    if (kind_ == Kind::Formula) {
+        cache_state_ = CacheState::Dirty;
+    }
+}
 
-void Cell::Clear() {
-    impl_ = std::make_unique<EmptyImpl>();
-    RecursiveRecalculateValueCycle();
+bool Cell::IsCacheValid() const {
+    // only formulas have something to calculate
+    return kind_ != Kind::Formula || cache_state_ != CacheState::Dirty;
 }
 
-Cell::Value Cell::GetValue() const {
-    // Возвращает видимое значение ячейки.
-    // В случае текстовой ячейки это её текст (без экранирующих символов). В
-    // случае формулы - числовое значение формулы или сообщение об ошибке.
-    return impl_->GetValue();
+std::optional<FormulaInterface::Value> Cell::GetCachedValue() const {
+    if (kind_ != Kind::Formula || cache_state_ == CacheState::Dirty) {
+        return std::nullopt;
+    }
+    return GetCache();
 }
 
-std::string Cell::GetText() const {
-    // Возвращает внутренний текст ячейки, как если бы мы начали её
-    // редактирование. В случае текстовой ячейки это её текст (возможно,
-    // содержащий экранирующие символы). В случае формулы - её выражение.
-    return impl_->GetRawValue();
+void Cell::SetCachedValue(FormulaInterface::Value value) {
+    SetCache(value);
 }
 
+const FormulaInterface* Cell::GetParsedFormula() const {
+    return GetFormula();
+}
 
+FormulaInterface::Value Cell::GetCache() const {
+    switch (cache_state_) {
+        case CacheState::RefError:
+            return FormulaError(FormulaError::Category::Ref);
+        case CacheState::ValueError:
+            return FormulaError(FormulaError::Category::Value);
+        case CacheState::Div0Error:
+            return FormulaError(FormulaError::Category::Div0);
+        default:
+            return cache_;
+    }
+}
 
-std::string EmptyImpl::GetRawValue() {
-    return "";
+void Cell::SetCache(FormulaInterface::Value value) const {
+    if (auto number = std::get_if<double>(&value)) {
+        cache_ = *number;
+        cache_state_ = CacheState::Number;
+        return;
+    }
+    switch (std::get<FormulaError>(value).GetCategory()) {
+        case FormulaError::Category::Ref:
+            cache_state_ = CacheState::RefError;
+            break;
+        case FormulaError::Category::Value:
+            cache_state_ = CacheState::ValueError;
+            break;
+        case FormulaError::Category::Div0:
+            cache_state_ = CacheState::Div0Error;
+            break;
+    }
 }
-Value EmptyImpl::GetValue() {
-    return "";
+
+void Cell::CalculateWithPrecedents(const Sheet& sheet) const {
+    struct Frame {
+        const Cell* cell;
+        std::vector<const Cell*> dirty_precedents;
+        size_t next = 0;
+    };
+
+    std::unordered_set<const Cell*> visited{this};
+    auto make_frame = [&sheet, &visited](const Cell* cell) {
+        Frame frame{cell, {}};
+        for (const auto& range : cell->GetReferencedRanges()) {
+            sheet.ForEachCellInRange(range, [&frame, &visited](Position, const Cell& precedent) {
+                if (!precedent.IsCacheValid() && visited.insert(&precedent).second) {
+                    frame.dirty_precedents.push_back(&precedent);
+                }
+            });
+        }
+        return frame;
+    };
+
+    std::vector<Frame> stack;
+    stack.push_back(make_frame(this));
+
+    while (!stack.empty()) {
+        auto& frame = stack.back();
+        if (frame.next < frame.dirty_precedents.size()) {
+            stack.push_back(make_frame(frame.dirty_precedents[frame.next++]));
+        } else {
+            // all referenced cells are calculated at this point
+            frame.cell->CalculateValue(sheet);
+            stack.pop_back();
+        }
+    }
 }
 
+void Cell::CalculateValue(const Sheet& sheet) const {
+    auto formula = GetFormula();
+    if (formula == nullptr) {
+        return;
+    }
 
-TextImpl::TextImpl(const std::string& text)
-        : raw_(text)
-{
-    complete_ = !text.empty() && text[0] == '\'' ? text.substr(1) : text;
+    // referenced cells are taken right from the sheet storage, only read here
+    auto cell_value = [&sheet](Position pos) -> FormulaInterface::Value {
+        auto cell = sheet.FindCell(pos);
+        if (cell == nullptr) {
+            return 0.0;
+        }
+        return cell->GetNumericValue();
+    };
+    auto range_numbers = [&sheet](CellRange range, std::vector<double>& numbers) {
+        return sheet.CollectNumbers(range, numbers);
+    };
+    SetCache(formula->Evaluate(FormulaInterface::CellLookup(cell_value, range_numbers)));
 }
 
-std::string TextImpl::GetRawValue() {
-    return raw_;
-}
-Value TextImpl::GetValue(){
-    return complete_;
+void Cell::Clear() {
+    content_.reset();
+    kind_ = Kind::Empty;
+    cache_state_ = CacheState::Dirty;
 }
 
+std::string_view Cell::GetVisibleText() const {
+    std::string_view text = GetRawText();
+    if (!text.empty() && text[0] == ESCAPE_SIGN) {
+        text.remove_prefix(1);
+    }
+    return text;
+}
 
-FormulaImpl::FormulaImpl(const std::string& expression, SheetInterface* sheet)
-    : sheet_(sheet)
-{
-    expr_ = ParseFormula(expression.substr(1));
-
-    raw_ = "=" + expr_->GetExpression();
+Cell::Value Cell::GetValue() const {
+    // Возвращает видимое значение ячейки.
+    // В случае текстовой ячейки это её текст (без экранирующих символов). В
+    // случае формулы - числовое значение формулы или сообщение об ошибке.
+    if (kind_ == Kind::Text) {
+        return std::string(GetVisibleText());
+    }
+    if (kind_ == Kind::Empty) {
+        return "";
+    }
+    if (cache_state_ == CacheState::Dirty) {
+        CalculateWithPrecedents(CellStorage::GetSheet(*this));
+    }
+    return std::visit([](const auto& value) -> Value { return value; }, GetCache());
+}
 
-    CalculateValue();
+FormulaInterface::Value Cell::GetNumericValue() const {
+    if (kind_ == Kind::Empty) {
+        return 0.0;
+    }
+    if (cache_state_ == CacheState::Dirty) {
+        CalculateWithPrecedents(CellStorage::GetSheet(*this));
+    }
+    return GetCache();
 }
 
-void FormulaImpl::CalculateValue() {
+std::optional<FormulaInterface::Value> Cell::GetRangeValue() const {
+    if (kind_ == Kind::Text) {
+        if (GetVisibleText().empty() || cache_state_ != CacheState::Number) {
+            return std::nullopt;
+        }
+        return cache_;
+    }
+    if (kind_ == Kind::Empty) {
+        return std::nullopt;
+    }
+    return GetNumericValue();
+}
 
-    auto result = expr_->Evaluate(*sheet_);
+std::string Cell::GetText() const {
+    // Возвращает внутренний текст ячейки, как если бы мы начали её
+    // редактирование. В случае текстовой ячейки это её текст (возможно,
+    // содержащий экранирующие символы). В случае формулы - её выражение.
+    if (kind_ == Kind::Text) {
+        return GetRawText();
+    }
+    if (auto formula = GetFormula()) {
+        return FORMULA_SIGN + formula->GetExpression();
+    }
+    return "";
+}
 
-    if (std::holds_alternative<FormulaError>(result)) {
-        complete_ = std::get<FormulaError>(result);
+void Cell::AppendValue(std::string& buffer) const {
+    if (kind_ == Kind::Text) {
+        buffer += GetVisibleText();
         return;
     }
-
-    if (std::holds_alternative<double>(result)) {
-        complete_ = std::get<double>(result);
+    if (kind_ == Kind::Empty) {
         return;
     }
+    assert(cache_state_ != CacheState::Dirty);
+    if (cache_state_ == CacheState::Number) {
+        AppendNumber(buffer, cache_);
+    } else {
+        buffer += std::get<FormulaError>(GetCache()).ToString();
+    }
 }
 
-std::string FormulaImpl::GetRawValue() {
-    return raw_;
-}
-Value FormulaImpl::GetValue() {
-    return complete_;
-}
-
-std::vector<Position> FormulaImpl::GetReferencedCells() const {
-    return expr_->GetReferencedCells();
+void Cell::AppendText(std::string& buffer) const {
+    if (kind_ == Kind::Text) {
+        buffer += GetRawText();
+    } else if (auto formula = GetFormula()) {
+        buffer += FORMULA_SIGN;
+        buffer += formula->GetExpression();
+    }
 }
 
 std::vector<Position> Cell::GetReferencedCells() const {
-    return impl_->GetReferencedCells();
-}
\ No newline at end of file
+    if (auto formula = GetFormula()) {
+        return formula->GetReferencedCells();
+    }
+    return {};
+}
@@ -3,88 +3,111 @@
 #include "common.h"
 #include "formula.h"
 
+#include <cstdint>
 #include <functional>
+#include <memory>
+#include <optional>
+#include <string>
 #include <unordered_set>
+#include <variant>
 
 #include <iostream>
 
 class Sheet;
 
-class Impl {
+// Cell record kept by value in the sheet storage, the sheet is found by the
+// storage chunk holding the record. Texts and formulas are out-of-line handles
+// shared by copies of the record, the cached value is a number or an error tag.
+class Cell final : public CellInterface {
 public:
-    Impl() = default;
-    virtual ~Impl() = default;
-    virtual std::string GetRawValue() = 0;
-    virtual CellInterface::Value GetValue() = 0;
-    virtual std::vector<Position> GetReferencedCells() const = 0;
-    virtual void CalculateValue() {};
-};
-
-class EmptyImpl final : public Impl {
-public:
-    EmptyImpl() = default;
-
-    std::string GetRawValue() override;
-    CellInterface::Value GetValue() override;
-    std::vector<Position> GetReferencedCells() const override {
-        return {};
-    }
-};
-
-class TextImpl final : public Impl {
-public:
-    explicit TextImpl(const std::string& text);
-
-    std::string GetRawValue() override;
-    CellInterface::Value GetValue() override;
-    std::vector<Position> GetReferencedCells() const override {
-        return {};
-    }
-private:
-    std::string raw_;
-    CellInterface::Value complete_;
-};
-
-class FormulaImpl final : public Impl {
-public:
-    explicit FormulaImpl(const std::string& expression, SheetInterface* sheet);
-
-    std::string GetRawValue() override;
-    CellInterface::Value GetValue() override;
-    std::vector<Position> GetReferencedCells() const override;
-
-    void CalculateValue() override;
-
-private:
-    SheetInterface* sheet_;
-    std::string raw_;
-    CellInterface::Value complete_;
-    std::unique_ptr<FormulaInterface> expr_;
-};
-
-
-class Cell : public CellInterface {
-public:
-    Cell(SheetInterface& sheet);
+    // empty cell, only cells of CellStorage are calculated
+    Cell() = default;
+    // copied by the storage when a cell shared with a view is changed
+    Cell(const Cell& other) = default;
     ~Cell();
 
-    void Set(std::string text);
+    // formula is the already parsed text of a formula cell, it's parsed here if not given
+    void Set(std::string text, std::shared_ptr<const FormulaInterface> formula = nullptr);
+    // Makes a formula cell of an already parsed formula
+    void SetFormula(std::shared_ptr<const FormulaInterface> formula);
     void Clear();
 
     Value GetValue() const override;
+    // Value as seen from formulas referencing the cell
+    FormulaInterface::Value GetNumericValue() const;
+    // Value taken by functions over ranges, nothing for empty cells and text
+    // which is not a number
+    std::optional<FormulaInterface::Value> GetRangeValue() const;
     std::string GetText() const override;
     std::vector<Position> GetReferencedCells() const override;
 
-    // without itself recalculation
-    void RecursiveRecalculateValueCycle();
+    // Append GetValue() and GetText() to buffer. Numbers are formatted as by
+    // std::ostream, value of a formula is expected to be calculated
+    void AppendValue(std::string& buffer) const;
+    void AppendText(std::string& buffer) const;
+
+    // Recalculates own value only with cells of sheet, dependent cells are
+    // refreshed by Sheet
+    void Recalculate(const Sheet& sheet);
+    void InvalidateCache();
+    bool IsCacheValid() const;
+    // Calculated value of a formula, nothing for other cells and dirty formulas
+    std::optional<FormulaInterface::Value> GetCachedValue() const;
+    // Value of the formula calculated before, e.g. restored from a snapshot
+    void SetCachedValue(FormulaInterface::Value value);
+
+    // Formula of a formula cell shared with other cells, nullptr for other cells
+    const FormulaInterface* GetParsedFormula() const;
 
-    void RecursiveRecalculateValue();
+    // Cells referenced by the formula as rectangles, empty for other cells
+    const std::vector<CellRange>& GetReferencedRanges() const;
 
-    void AddDependency(Position pos);
-    void DeleteDependency(Position pos);
+    // Position in topological order of the dependency graph maintained by Sheet:
+    // every cell is ordered before the formulas referencing it
+    int GetOrder() const;
+    void SetOrder(int order);
 
 private:
-    SheetInterface* sheet_;
-    std::unique_ptr<Impl> impl_;
-    std::vector<Position> depends_from_this_;
+    enum class Kind : uint8_t {
+        Empty,
+        Text,     // content_ is std::string
+        Formula,  // content_ is FormulaInterface
+    };
+
+    // what cache_ holds, errors are told by their category
+    enum class CacheState : uint8_t {
+        Dirty,
+        Number,
+        RefError,
+        ValueError,
+        Div0Error,
+    };
+
+    // Calculates dirty referenced cells (transitively) before this one,
+    // iteratively so long chains of formulas don't exhaust the stack
+    void CalculateWithPrecedents(const Sheet& sheet) const;
+    void CalculateValue(const Sheet& sheet) const;
+
+    const FormulaInterface* GetFormula() const {
+        return kind_ == Kind::Formula ? static_cast<const FormulaInterface*>(content_.get()) : nullptr;
+    }
+    const std::string& GetRawText() const {
+        return *static_cast<const std::string*>(content_.get());
+    }
+
+    // text of a text cell without the escape sign
+    std::string_view GetVisibleText() const;
+
+    FormulaInterface::Value GetCache() const;
+    void SetCache(FormulaInterface::Value value) const;
+
+    // raw text or formula shared with other cells and the formula cache,
+    // nullptr for empty cells
+    std::shared_ptr<const void> content_;
+    // number of a formula cell, valid only while cache_state_ is not Dirty, or the
+    // number in a text cell taken once the text is set, see TextToNumber()
+    mutable double cache_ = 0.0;
+    int order_ = 0;
+    Kind kind_ = Kind::Empty;
+    mutable CacheState cache_state_ = CacheState::Dirty;
 };
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <iosfwd>
 #include <memory>
 #include <stdexcept>
@@ -15,17 +19,132 @@ struct Position {
     int row = 0;
     int col = 0;
 
-    bool operator==(Position rhs) const;
-    bool operator<(Position rhs) const;
+    constexpr bool operator==(Position rhs) const {
+        return row == rhs.row && col == rhs.col;
+    }
+    constexpr bool operator<(Position rhs) const {
+        return row < rhs.row || (row == rhs.row && col < rhs.col);
+    }
 
-    bool IsValid() const;
+    constexpr bool IsValid() const {
+        return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
+    }
     std::string ToString() const;
+    // Writes A1 notation to out of at least MAX_STRING_LENGTH chars without allocation,
+    // returns the number of chars written, 0 for an invalid position
+    constexpr size_t ToChars(char* out) const;
+
+    // NONE if str is not A1 notation, a position out of the sheet is invalid otherwise
+    static constexpr Position FromString(std::string_view str);
 
-    static Position FromString(std::string_view str);
+    // Valid position packed to 32 bits. Keys are ordered as positions, so they may
+    // replace them in hash tables and sorted arrays
+    constexpr uint32_t ToKey() const {
+        return static_cast<uint32_t>(row) << COL_BITS | static_cast<uint32_t>(col);
+    }
+    static constexpr Position FromKey(uint32_t key) {
+        return {static_cast<int>(key >> COL_BITS), static_cast<int>(key & (MAX_COLS - 1))};
+    }
+    // Same with bits of row and col interleaved (Z-order), so cells of a tile are
+    // next to each other and tiles close in both directions have close keys
+    constexpr uint32_t ToMortonKey() const {
+        return SpreadBits(row) << 1 | SpreadBits(col);
+    }
+    static constexpr Position FromMortonKey(uint32_t key) {
+        return {static_cast<int>(CompactBits(key >> 1)), static_cast<int>(CompactBits(key))};
+    }
 
     static const int MAX_ROWS = 16384;
     static const int MAX_COLS = 16384;
+    static const int COL_BITS = 14;
+    // "XFD16384"
+    static const size_t MAX_STRING_LENGTH = 8;
     static const Position NONE;
+
+private:
+    // bits 0..15 of x to even bits of the result
+    static constexpr uint32_t SpreadBits(uint32_t x) {
+        x &= 0xFFFF;
+        x = (x | x << 8) & 0x00FF00FF;
+        x = (x | x << 4) & 0x0F0F0F0F;
+        x = (x | x << 2) & 0x33333333;
+        x = (x | x << 1) & 0x55555555;
+        return x;
+    }
+    static constexpr uint32_t CompactBits(uint32_t x) {
+        x &= 0x55555555;
+        x = (x | x >> 1) & 0x33333333;
+        x = (x | x >> 2) & 0x0F0F0F0F;
+        x = (x | x >> 4) & 0x00FF00FF;
+        x = (x | x >> 8) & 0x0000FFFF;
+        return x;
+    }
+};
+
+static_assert(Position::MAX_COLS == 1 << Position::COL_BITS && Position::MAX_ROWS <= 1 << 16,
+              "packed keys hold row and col in 32 bits");
+
+constexpr size_t Position::ToChars(char* out) const {
+    if (!IsValid()) {
+        return 0;
+    }
+
+    // letters are written backwards, then turned around
+    size_t size = 0;
+    for (int c = col; c >= 0; c = c / 26 - 1) {
+        out[size++] = static_cast<char>('A' + c % 26);
+    }
+    for (size_t i = 0; i < size / 2; ++i) {
+        char letter = out[i];
+        out[i] = out[size - 1 - i];
+        out[size - 1 - i] = letter;
+    }
+
+    char digits[5] = {};
+    size_t digit_count = 0;
+    for (int r = row + 1; r > 0; r /= 10) {
+        digits[digit_count++] = static_cast<char>('0' + r % 10);
+    }
+    while (digit_count > 0) {
+        out[size++] = digits[--digit_count];
+    }
+    return size;
+}
+
+constexpr Position Position::FromString(std::string_view str) {
+    constexpr size_t MAX_LETTER_COUNT = 3;
+    const Position none{-1, -1};
+
+    size_t letter_count = 0;
+    int col = 0;
+    while (letter_count < str.size() && str[letter_count] >= 'A' && str[letter_count] <= 'Z') {
+        col = col * 26 + (str[letter_count] - 'A' + 1);
+        ++letter_count;
+        if (letter_count > MAX_LETTER_COUNT) {
+            return none;
+        }
+    }
+    if (letter_count == 0 || letter_count == str.size()) {
+        return none;
+    }
+
+    // rows past the sheet are kept at MAX_ROWS + 1, so they don't overflow
+    int row = 0;
+    for (size_t i = letter_count; i < str.size(); ++i) {
+        if (str[i] < '0' || str[i] > '9') {
+            return none;
+        }
+        row = std::min(row * 10 + (str[i] - '0'), MAX_ROWS + 1);
+    }
+
+    return {row - 1, col - 1};
+}
+
+// Hash of any position for unordered containers, the packed key of a valid one
+struct PositionHasher {
+    size_t operator()(Position pos) const {
+        return std::hash<uint32_t>{}(pos.ToKey());
+    }
 };
 
 struct Size {
@@ -35,6 +154,22 @@ struct Size {
     bool operator==(Size rhs) const;
 };
 
+// Rectangular block of cells between two corners inclusive, A1:B10 in formulas
+struct CellRange {
+    Position first;  // top left corner
+    Position last;   // bottom right corner
+
+    bool operator==(CellRange rhs) const;
+
+    // Range with corners given in any order
+    static CellRange FromCorners(Position lhs, Position rhs);
+
+    bool IsValid() const;
+    bool Contains(Position pos) const;
+    Size GetSize() const;
+    std::string ToString() const;
+};
+
 // Описывает ошибки, которые могут возникнуть при вычислении формулы.
 class FormulaError {
 public:
@@ -93,6 +228,13 @@ public:
     using std::runtime_error::runtime_error;
 };
 
+// Thrown when loading data which is not a damage-free sheet snapshot of a
+// supported version
+class SnapshotException : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
 class CellInterface {
 public:
     // Либо текст ячейки, либо значение формулы, либо сообщение об ошибке из
@@ -0,0 +1,154 @@
+#include "dependency_index.h"
+
+#include <algorithm>
+#include <cassert>
+
+int DependencyIndex::GetLevel(CellRange range) {
+    auto size = range.GetSize();
+    int side = std::max(size.rows, size.cols);
+    int level = 0;
+    while (GetBucketSide(level) < side) {
+        ++level;
+    }
+    assert(level < LEVELS);
+    return level;
+}
+
+void DependencyIndex::Add(CellRange range, Position dependent) {
+    uint32_t id;
+    if (!free_ids_.empty()) {
+        id = free_ids_.back();
+        free_ids_.pop_back();
+    } else {
+        id = static_cast<uint32_t>(references_.size());
+        references_.emplace_back();
+    }
+
+    // the new reference goes to the head of the formula's list
+    auto [first, is_new] = first_references_.emplace(dependent, id);
+    auto& reference = references_[id];
+    reference.range = range;
+    reference.dependent = dependent;
+    reference.next = is_new ? NO_ID : first->second;
+    first->second = id;
+
+    int level = GetLevel(range);
+    auto& grid = grids_[level];
+    size_t bucket_index = 0;
+    ForEachBucketKey(range, level, [&](uint32_t key) {
+        auto& entries = grid.buckets[key];
+        reference.entry_indexes[bucket_index++] = static_cast<uint32_t>(entries.size());
+        entries.push_back({range, dependent, id});
+    });
+    ++grid.size;
+}
+
+void DependencyIndex::Remove(CellRange range, Position dependent) {
+    auto first = first_references_.find(dependent);
+    if (first == first_references_.end()) {
+        return;
+    }
+    // formulas have a few references, so the list is short
+    uint32_t* link = &first->second;
+    while (*link != NO_ID && !(references_[*link].range == range)) {
+        link = &references_[*link].next;
+    }
+    if (*link == NO_ID) {
+        return;
+    }
+    const uint32_t id = *link;
+    *link = references_[id].next;
+    if (first->second == NO_ID) {
+        first_references_.erase(first);
+    }
+
+    int level = GetLevel(range);
+    auto& grid = grids_[level];
+    size_t bucket_index = 0;
+    ForEachBucketKey(range, level, [&](uint32_t key) {
+        RemoveEntry(grid, level, key, references_[id].entry_indexes[bucket_index++]);
+    });
+    --grid.size;
+
+    references_[id].dependent = Position::NONE;
+    free_ids_.push_back(id);
+    if (free_ids_.size() >= MIN_COMPACTED_IDS && free_ids_.size() * 2 > references_.size()) {
+        Compact();
+    }
+}
+
+void DependencyIndex::RemoveEntry(Grid& grid, int level, uint32_t key, uint32_t index) {
+    auto bucket = grid.buckets.find(key);
+    auto& entries = bucket->second;
+    if (index + 1 != entries.size()) {
+        // the moved entry is found among the buckets of its reference by the key
+        entries[index] = entries.back();
+        auto& moved = references_[entries[index].id];
+        size_t bucket_index = 0;
+        ForEachBucketKey(moved.range, level, [&](uint32_t moved_key) {
+            if (moved_key == key) {
+                moved.entry_indexes[bucket_index] = index;
+            }
+            ++bucket_index;
+        });
+    }
+    entries.pop_back();
+
+    if (entries.empty()) {
+        grid.buckets.erase(bucket);
+    } else if (entries.size() * 4 < entries.capacity()) {
+        // buckets of hot cells don't keep their peak memory
+        entries.shrink_to_fit();
+    }
+}
+
+void DependencyIndex::Compact() {
+    std::vector<uint32_t> new_ids(references_.size(), NO_ID);
+    std::vector<Reference> references;
+    references.reserve(references_.size() - free_ids_.size());
+    for (uint32_t id = 0; id < references_.size(); ++id) {
+        if (!(references_[id].dependent == Position::NONE)) {
+            new_ids[id] = static_cast<uint32_t>(references.size());
+            references.push_back(references_[id]);
+        }
+    }
+
+    for (auto& reference : references) {
+        if (reference.next != NO_ID) {
+            reference.next = new_ids[reference.next];
+        }
+    }
+    for (auto& [dependent, id] : first_references_) {
+        id = new_ids[id];
+    }
+    for (auto& grid : grids_) {
+        for (auto& [key, entries] : grid.buckets) {
+            for (auto& entry : entries) {
+                entry.id = new_ids[entry.id];
+            }
+        }
+    }
+
+    references_ = std::move(references);
+    free_ids_.clear();
+    free_ids_.shrink_to_fit();
+}
+
+bool DependencyIndex::HasDependents(Position pos) const {
+    for (int level = 0; level < LEVELS; ++level) {
+        const auto& grid = grids_[level];
+        if (grid.size == 0) {
+            continue;
+        }
+        auto bucket = grid.buckets.find(GetBucketKey(pos, level));
+        if (bucket == grid.buckets.end()) {
+            continue;
+        }
+        for (const auto& entry : bucket->second) {
+            if (entry.range.Contains(pos)) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,120 @@
+#pragma once
+
+#include "common.h"
+
+#include <array>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Spatial index of formula references answering which formulas depend on a
+// position. References are rectangles kept in a hierarchy of grids with bucket
+// sides of 1, 4, 16, ... cells: a rectangle goes to the finest grid whose buckets
+// are not smaller than the rectangle, so it's put into at most 2x2 buckets there,
+// and a lookup checks a single bucket per grid.
+//
+// Every reference has a dense id keeping its places in the buckets and the next
+// reference of the same formula, so it's removed in O(1) however many other
+// references share its buckets. Ids of removed references are reused, and they are
+// renumbered by a compaction pass when most of them are free.
+class DependencyIndex {
+public:
+    // Formula in dependent references cells of range
+    void Add(CellRange range, Position dependent);
+    // Removes a reference added with the same arguments
+    void Remove(CellRange range, Position dependent);
+
+    // Calls func(Position) for every formula referencing pos, a formula referencing
+    // pos by several ranges is reported once per range
+    template <typename Func>
+    void ForEachDependent(Position pos, Func&& func) const;
+    bool HasDependents(Position pos) const;
+
+private:
+    static constexpr uint32_t NO_ID = UINT32_MAX;
+    // compaction doesn't pay off for fewer free ids
+    static constexpr size_t MIN_COMPACTED_IDS = 1024;
+
+    // copy of a reference in a bucket
+    struct Entry {
+        CellRange range;
+        Position dependent;
+        uint32_t id;
+    };
+
+    struct Reference {
+        CellRange range;
+        // Position::NONE for free ids
+        Position dependent;
+        // next reference of the same formula, NO_ID for the last one
+        uint32_t next;
+        // indexes of the entries in buckets of the range, see ForEachBucketKey()
+        std::array<uint32_t, 4> entry_indexes;
+    };
+
+    struct Grid {
+        std::unordered_map<uint32_t, std::vector<Entry>> buckets;
+        // references in the grid, each of them is in 1 to 4 buckets
+        size_t size = 0;
+    };
+
+    // the coarsest grid is a single bucket covering the whole sheet
+    static constexpr int LEVELS = 8;
+
+    static int GetBucketSide(int level) {
+        return 1 << (2 * level);
+    }
+
+    // packed key of the bucket's corner, buckets of all levels tile the sheet
+    static uint32_t GetBucketKey(Position pos, int level) {
+        int side = GetBucketSide(level);
+        return Position{pos.row / side * side, pos.col / side * side}.ToKey();
+    }
+
+    static int GetLevel(CellRange range);
+
+    // Calls func(uint32_t key) for buckets of range at level in the same order every time
+    template <typename Func>
+    static void ForEachBucketKey(CellRange range, int level, Func&& func);
+
+    // Removes the entry at index of bucket, the last entry takes its place
+    void RemoveEntry(Grid& grid, int level, uint32_t key, uint32_t index);
+    // Renumbers references densely, so free ids are dropped
+    void Compact();
+
+    std::array<Grid, LEVELS> grids_;
+
+    std::vector<Reference> references_;
+    std::vector<uint32_t> free_ids_;
+    // the first reference of every formula, others are linked by Reference::next
+    std::unordered_map<Position, uint32_t, PositionHasher> first_references_;
+};
+
+template <typename Func>
+void DependencyIndex::ForEachDependent(Position pos, Func&& func) const {
+    for (int level = 0; level < LEVELS; ++level) {
+        const auto& grid = grids_[level];
+        if (grid.size == 0) {
+            continue;
+        }
+        auto bucket = grid.buckets.find(GetBucketKey(pos, level));
+        if (bucket == grid.buckets.end()) {
+            continue;
+        }
+        for (const auto& entry : bucket->second) {
+            if (entry.range.Contains(pos)) {
+                func(entry.dependent);
+            }
+        }
+    }
+}
+
+template <typename Func>
+void DependencyIndex::ForEachBucketKey(CellRange range, int level, Func&& func) {
+    int side = GetBucketSide(level);
+    for (int row = range.first.row / side; row <= range.last.row / side; ++row) {
+        for (int col = range.first.col / side; col <= range.last.col / side; ++col) {
+            func(GetBucketKey({row * side, col * side}, level));
+        }
+    }
+}
@@ -5,6 +5,8 @@
 #include <algorithm>
 #include <cassert>
 #include <cctype>
+#include <charconv>
+#include <iterator>
 #include <sstream>
 
 #include <variant>
@@ -21,84 +23,181 @@ namespace {
     // Реализуйте следующие методы:
     explicit Formula(std::string expression) try
             : ast_(ParseFormulaAST(expression)) {
+        std::stringstream outline;
+        ast_.PrintFormula(outline);
+        expression_ = outline.str();
+
+        for (auto cell : ast_.GetCells()) {
+            referenced_.push_back({cell, cell});
+        }
+        referenced_.insert(referenced_.end(), ast_.GetRanges().begin(), ast_.GetRanges().end());
+        std::sort(referenced_.begin(), referenced_.end(), [](CellRange lhs, CellRange rhs) {
+            return lhs.first == rhs.first ? lhs.last < rhs.last : lhs.first < rhs.first;
+        });
+        referenced_.erase(std::unique(referenced_.begin(), referenced_.end()), referenced_.end());
     } catch (const std::exception& exc) {
         throw(FormulaException(exc.what()));
     }
 
         Value Evaluate(const SheetInterface& sheet) const override  {
+            auto cell_value = [&sheet](Position pos) -> Value {
+                if (!pos.IsValid()) {
+                    return FormulaError(FormulaError::Category::Ref);
+                }
 
-            Value result;
-
-            try {
-                result = ast_.Execute([&sheet](Position pos) {
-
-                    if (!pos.IsValid()) {
-                        throw FormulaError(FormulaError::Category::Ref);
-                    }
-
-                    auto cell = sheet.GetCell(pos);
-                    if (cell == nullptr) {
-                        return 0.0;
-                    }
-
-                    auto cell_value = cell->GetValue();
+                auto cell = sheet.GetCell(pos);
+                if (cell == nullptr) {
+                    return 0.0;
+                }
 
-                    if (std::holds_alternative<double>(cell_value)) {
-                        return std::get<double>(cell_value);
-                    }
+                auto value = cell->GetValue();
 
-                    if (std::holds_alternative<FormulaError>(cell_value)) {
-                        throw std::get<FormulaError>(cell_value);
-                    }
+                if (std::holds_alternative<double>(value)) {
+                    return std::get<double>(value);
+                }
 
-                    if (std::holds_alternative<std::string>(cell_value)) {
-                        double result = 0.0;
-                        std::string str = std::get<std::string>(cell_value);
-                        if (str.empty()) {
-                            return result;
-                        }
+                if (std::holds_alternative<FormulaError>(value)) {
+                    return std::get<FormulaError>(value);
+                }
 
-                        if (str.find_first_not_of("1234567890.") != str.npos) {
-                            throw FormulaError(FormulaError::Category::Value);
+                return TextToNumber(std::get<std::string>(value));
+            };
+            auto range_numbers = [&sheet](CellRange range,
+                                          std::vector<double>& numbers) -> std::optional<FormulaError> {
+                for (int row = range.first.row; row <= range.last.row; ++row) {
+                    for (int col = range.first.col; col <= range.last.col; ++col) {
+                        auto cell = sheet.GetCell({row, col});
+                        if (cell == nullptr) {
+                            continue;
                         }
 
-                        try {
-                            result = std::stod(str);
+                        auto value = cell->GetValue();
+                        if (auto text = std::get_if<std::string>(&value)) {
+                            if (text->empty()) {
+                                continue;
+                            }
+                            auto number = TextToNumber(*text);
+                            if (std::holds_alternative<double>(number)) {
+                                numbers.push_back(std::get<double>(number));
+                            }
+                        } else if (auto number = std::get_if<double>(&value)) {
+                            numbers.push_back(*number);
+                        } else {
+                            return std::get<FormulaError>(value);
                         }
-                        catch (...) {
-                            throw FormulaError(FormulaError::Category::Value);
-                        }
-                        return result;
                     }
-                    return 0.0;
                 }
-                );
-            }
-            catch (FormulaError& err) {
-                return err;
-            }
-            return result;
+                return std::nullopt;
+            };
+            return ast_.Execute(CellLookup(cell_value, range_numbers));
+        }
+
+        Value Evaluate(const CellLookup& lookup) const override {
+            return ast_.Execute(lookup);
         }
 
         std::string GetExpression() const override {
-            std::stringstream outline;
-            ast_.PrintFormula(outline);
-            return outline.str();
+            return expression_;
         }
 
         std::vector<Position> GetReferencedCells() const override {
-            auto cells = ast_.GetCells();
-            std::vector<Position> result(cells.begin(), cells.end());
-            auto it = std::unique(result.begin(), result.end());
-            result.erase(it, result.end());
+            std::vector<Position> result(ast_.GetCells().begin(), ast_.GetCells().end());
+            if (!ast_.GetRanges().empty()) {
+                for (const auto& range : ast_.GetRanges()) {
+                    for (int row = range.first.row; row <= range.last.row; ++row) {
+                        for (int col = range.first.col; col <= range.last.col; ++col) {
+                            result.push_back({row, col});
+                        }
+                    }
+                }
+                std::sort(result.begin(), result.end());
+            }
+            result.erase(std::unique(result.begin(), result.end()), result.end());
             return result;
         }
 
+        const std::vector<CellRange>& GetReferencedRanges() const override {
+            return referenced_;
+        }
+
     private:
         FormulaAST ast_;
+        std::string expression_;
+        std::vector<CellRange> referenced_;
     };
 }  // namespace
 
 std::unique_ptr<FormulaInterface> ParseFormula(std::string expression) {
     return std::make_unique<Formula>(std::move(expression));
+}
+
+FormulaInterface::Value TextToNumber(std::string_view text) {
+    if (text.empty()) {
+        return 0.0;
+    }
+
+    if (text.find_first_not_of("1234567890.") != text.npos) {
+        return FormulaError(FormulaError::Category::Value);
+    }
+
+    // same as std::stod: the longest prefix being a number is taken
+    double result = 0.0;
+    if (std::from_chars(text.data(), text.data() + text.size(), result).ec != std::errc()) {
+        return FormulaError(FormulaError::Category::Value);
+    }
+    return result;
+}
+
+void AppendNumber(std::string& buffer, double number) {
+    // %g with 6 significant digits, the same as operator<<
+    char chars[32];
+    auto result = std::to_chars(std::begin(chars), std::end(chars), number, std::chars_format::general, 6);
+    buffer.append(chars, result.ptr);
+}
+
+FormulaCache::FormulaCache(size_t capacity)
+    : capacity_(std::max<size_t>(capacity, 1))
+{
+}
+
+std::shared_ptr<const FormulaInterface> FormulaCache::Parse(std::string_view expression) {
+    if (auto formula = Find(expression)) {
+        return formula;
+    }
+
+    std::shared_ptr<const FormulaInterface> formula = ParseFormula(std::string(expression));
+    Insert(expression, formula);
+    return formula;
+}
+
+std::shared_ptr<const FormulaInterface> FormulaCache::Find(std::string_view expression) {
+    auto it = index_.find(expression);
+    if (it == index_.end()) {
+        return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+}
+
+void FormulaCache::Insert(std::string_view expression, std::shared_ptr<const FormulaInterface> formula) {
+    if (auto it = index_.find(expression); it != index_.end()) {
+        entries_.splice(entries_.begin(), entries_, it->second);
+        it->second->second = std::move(formula);
+        return;
+    }
+
+    if (entries_.size() == capacity_) {
+        index_.erase(entries_.back().first);
+        entries_.pop_back();
+    }
+    entries_.emplace_front(std::string(expression), std::move(formula));
+    index_.emplace(entries_.front().first, entries_.begin());
+}
+
+size_t FormulaCache::GetSize() const {
+    return entries_.size();
+}
+
+size_t FormulaCache::GetCapacity() const {
+    return capacity_;
 }
\ No newline at end of file
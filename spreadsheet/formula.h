@@ -2,7 +2,11 @@
 
 #include "common.h"
 
+#include <list>
 #include <memory>
+#include <optional>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 
 // Формула, позволяющая вычислять и обновлять арифметическое выражение.
@@ -16,6 +20,44 @@ class FormulaInterface {
 public:
     using Value = std::variant<double, FormulaError>;
 
+    // Non-owning reference to callables giving values of referenced cells.
+    // cell_function(Position) returns the number in a cell or its error,
+    // range_function(CellRange, std::vector<double>&) appends numbers of the range
+    // cells and returns the first error met, if any. Unlike std::function it's
+    // never copied into the heap, so the evaluator can read cells straight from
+    // the storage.
+    class CellLookup {
+    public:
+        template <typename CellFunction, typename RangeFunction>
+        CellLookup(const CellFunction& cell_function, const RangeFunction& range_function)
+            : cell_function_(&cell_function)
+            , range_function_(&range_function)
+            , call_cell_([](const void* function, Position pos) -> Value {
+                return (*static_cast<const CellFunction*>(function))(pos);
+            })
+            , call_range_([](const void* function, CellRange range,
+                             std::vector<double>& numbers) -> std::optional<FormulaError> {
+                return (*static_cast<const RangeFunction*>(function))(range, numbers);
+            })
+        {
+        }
+
+        Value operator()(Position pos) const {
+            return call_cell_(cell_function_, pos);
+        }
+
+        // Empty cells and text which is not a number are skipped in ranges
+        std::optional<FormulaError> CollectNumbers(CellRange range, std::vector<double>& numbers) const {
+            return call_range_(range_function_, range, numbers);
+        }
+
+    private:
+        const void* cell_function_;
+        const void* range_function_;
+        Value (*call_cell_)(const void*, Position);
+        std::optional<FormulaError> (*call_range_)(const void*, CellRange, std::vector<double>&);
+    };
+
     virtual ~FormulaInterface() = default;
 
     // Обратите внимание, что в метод Evaluate() ссылка на таблицу передаётся
@@ -25,6 +67,8 @@ public:
     // возвращается именно эта ошибка. Если таких ошибок несколько, возвращается
     // любая.
     virtual Value Evaluate(const SheetInterface& sheet) const = 0;
+    // Same as above with values of referenced cells given by lookup
+    virtual Value Evaluate(const CellLookup& lookup) const = 0;
 
     // Возвращает выражение, которое описывает формулу.
     // Не содержит пробелов и лишних скобок.
@@ -33,9 +77,50 @@ public:
     // Возвращает список ячеек, которые непосредственно задействованы в вычислении
     // формулы. Список отсортирован по возрастанию и не содержит повторяющихся
     // ячеек.
+    // Cells of range arguments are included, so the list is built on every call.
     virtual std::vector<Position> GetReferencedCells() const = 0;
+
+    // Referenced cells and ranges as rectangles, a single cell is a 1x1 range.
+    // Sorted, without repeated ranges, but ranges may overlap. Built once on parsing.
+    virtual const std::vector<CellRange>& GetReferencedRanges() const = 0;
 };
 
 // Парсит переданное выражение и возвращает объект формулы.
 // Бросает FormulaException в случае, если формула синтаксически некорректна.
-std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
\ No newline at end of file
+std::unique_ptr<FormulaInterface> ParseFormula(std::string expression);
+
+// Number stored in a text cell referenced from a formula: empty text is zero,
+// text that isn't a number gives #VALUE! error
+FormulaInterface::Value TextToNumber(std::string_view text);
+
+// Appends number formatted as std::ostream does with default settings
+void AppendNumber(std::string& buffer, double number);
+
+// Bounded cache of parsed formulas keyed by expression text. Identical
+// expressions share one immutable formula object, least recently used
+// entries are evicted when the cache is full.
+class FormulaCache {
+public:
+    explicit FormulaCache(size_t capacity = 4096);
+
+    // Same as ParseFormula() but returns the cached formula if expression was
+    // parsed before. Bad expressions are not cached.
+    std::shared_ptr<const FormulaInterface> Parse(std::string_view expression);
+
+    // Cached formula of expression if any
+    std::shared_ptr<const FormulaInterface> Find(std::string_view expression);
+    // Caches formula of expression parsed elsewhere, e.g. by another thread
+    void Insert(std::string_view expression, std::shared_ptr<const FormulaInterface> formula);
+
+    size_t GetSize() const;
+    size_t GetCapacity() const;
+
+private:
+    using Entry = std::pair<std::string, std::shared_ptr<const FormulaInterface>>;
+
+    size_t capacity_;
+    // most recently used entries first
+    std::list<Entry> entries_;
+    // keys point to strings owned by entries_
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> index_;
+};
\ No newline at end of file
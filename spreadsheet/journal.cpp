@@ -0,0 +1,426 @@
+#include "journal.h"
+
+#include "mapped_file.h"
+#include "sheet.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <optional>
+#include <sstream>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// Journal layout, numbers are in the byte order of the writing machine:
+//
+//   char magic[8], uint32 version, uint32 byte order mark
+//   records until the end of file:
+//     char operation, int32 row, int32 col, uint32 text size, text,
+//     uint32 checksum of the bytes above
+namespace {
+    constexpr char JOURNAL_MAGIC[8] = {'S', 'H', 'E', 'E', 'T', 'J', 'N', 'L'};
+    constexpr uint32_t JOURNAL_VERSION = 1;
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+    constexpr size_t HEADER_SIZE = sizeof(JOURNAL_MAGIC) + 2 * sizeof(uint32_t);
+    // operation, row, col and text size
+    constexpr size_t RECORD_HEADER_SIZE = 1 + 3 * sizeof(uint32_t);
+    constexpr size_t CHECKSUM_SIZE = sizeof(uint32_t);
+
+    constexpr char SET_OPERATION = 'S';
+    constexpr char CLEAR_OPERATION = 'C';
+
+    // FNV-1a, enough to tell a record torn by a crash
+    uint32_t Checksum(std::string_view bytes) {
+        uint32_t hash = 2166136261u;
+        for (char c : bytes) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 16777619u;
+        }
+        return hash;
+    }
+
+    template <typename Number>
+    void AppendNumber(std::string& buffer, Number number) {
+        char bytes[sizeof(Number)];
+        std::memcpy(bytes, &number, sizeof(Number));
+        buffer.append(bytes, sizeof(Number));
+    }
+
+    template <typename Number>
+    Number ReadNumber(std::string_view data, size_t offset) {
+        Number number;
+        std::memcpy(&number, data.data() + offset, sizeof(Number));
+        return number;
+    }
+
+    std::string MakeHeader() {
+        std::string header(JOURNAL_MAGIC, sizeof(JOURNAL_MAGIC));
+        AppendNumber(header, JOURNAL_VERSION);
+        AppendNumber(header, BYTE_ORDER_MARK);
+        return header;
+    }
+
+    struct JournalRecord {
+        char operation;
+        Position pos;
+        std::string_view text;
+    };
+
+    // Calls func(JournalRecord) for records of the journal up to the first torn one,
+    // returns the size of the journal without it. A header torn by a crash in Reset()
+    // is an empty journal of size 0
+    template <typename Func>
+    size_t ForEachRecord(std::string_view data, const std::string& path, Func&& func) {
+        const std::string header = MakeHeader();
+        if (data.size() < HEADER_SIZE && header.compare(0, data.size(), data) == 0) {
+            return 0;
+        }
+        if (data.substr(0, HEADER_SIZE) != header) {
+            throw std::runtime_error("Not a journal of this version: " + path);
+        }
+
+        size_t offset = HEADER_SIZE;
+        while (data.size() - offset >= RECORD_HEADER_SIZE + CHECKSUM_SIZE) {
+            size_t text_size = ReadNumber<uint32_t>(data, offset + 9);
+            if (data.size() - offset < RECORD_HEADER_SIZE + text_size + CHECKSUM_SIZE) {
+                break;
+            }
+            auto bytes = data.substr(offset, RECORD_HEADER_SIZE + text_size);
+            if (ReadNumber<uint32_t>(data, offset + bytes.size()) != Checksum(bytes)) {
+                break;
+            }
+
+            char operation = bytes[0];
+            if (operation != SET_OPERATION && operation != CLEAR_OPERATION) {
+                break;
+            }
+            Position pos{ReadNumber<int32_t>(data, offset + 1), ReadNumber<int32_t>(data, offset + 5)};
+            func(JournalRecord{operation, pos, bytes.substr(RECORD_HEADER_SIZE)});
+            offset += bytes.size() + CHECKSUM_SIZE;
+        }
+        return offset;
+    }
+
+    void Sync(std::FILE* file) {
+#ifdef _WIN32
+        int result = _commit(_fileno(file));
+#else
+        int result = fsync(fileno(file));
+#endif
+        if (result != 0) {
+            throw std::runtime_error("Can't sync journal");
+        }
+    }
+
+    // Makes a rename in the directory of path durable, Windows has no such call
+    void SyncDirectory(const std::string& path) {
+#ifndef _WIN32
+        auto directory = std::filesystem::absolute(path).parent_path().string();
+        int fd = open(directory.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("Can't open " + directory);
+        }
+        int result = fsync(fd);
+        close(fd);
+        if (result != 0) {
+            throw std::runtime_error("Can't sync " + directory);
+        }
+#else
+        (void)path;
+#endif
+    }
+
+    void WriteAll(std::FILE* file, std::string_view data, const std::string& path) {
+        if (std::fwrite(data.data(), 1, data.size(), file) != data.size() || std::fflush(file) != 0) {
+            throw std::runtime_error("Can't write " + path);
+        }
+    }
+}  // namespace
+
+EditJournal::EditJournal(std::string path, JournalOptions options)
+    : path_(std::move(path))
+    , options_(options)
+{
+    std::error_code error;
+    size_t size = 0;
+    if (std::filesystem::file_size(path_, error) > 0 && !error) {
+        MappedFile file(path_);
+        size = ForEachRecord(file.GetData(), path_, [](const JournalRecord&) {});
+    }
+
+    if (size > 0) {
+        // appending after a torn record would hide the new ones from replay
+        std::filesystem::resize_file(path_, size);
+        file_ = std::fopen(path_.c_str(), "ab");
+        if (file_ == nullptr) {
+            throw std::runtime_error("Can't open " + path_);
+        }
+        // a failed write leaves nothing buffered to be written after a retry
+        std::setvbuf(file_, nullptr, _IONBF, 0);
+        committed_size_ = size;
+    } else {
+        Reset();
+    }
+    committer_ = std::thread([this] {
+        RunCommitter();
+    });
+}
+
+EditJournal::~EditJournal() {
+    {
+        std::lock_guard lock(mutex_);
+        is_closing_ = true;
+    }
+    pending_condition_.notify_one();
+    committer_.join();
+
+    try {
+        Commit();
+    } catch (const std::runtime_error&) {
+        // edits that are not committed are lost as in a crash
+    }
+    if (file_ != nullptr) {
+        std::fclose(file_);
+    }
+}
+
+void EditJournal::RunCommitter() {
+    std::unique_lock lock(mutex_);
+    while (!is_closing_) {
+        if (pending_count_ == 0) {
+            pending_condition_.wait(lock);
+            continue;
+        }
+        auto due_time = first_pending_time_ + options_.max_delay;
+        if (std::chrono::steady_clock::now() < due_time) {
+            pending_condition_.wait_until(lock, due_time);
+            continue;
+        }
+        try {
+            CommitPending(lock);
+        } catch (const std::runtime_error&) {
+            // the edits stay pending, the next edit or Commit() throws if it fails again
+            pending_condition_.wait_for(lock, std::max(options_.max_delay, std::chrono::milliseconds(1)));
+        }
+    }
+}
+
+void EditJournal::LogSet(Position pos, std::string_view text) {
+    std::unique_lock lock(mutex_);
+    size_t size = buffer_.size();
+    AppendRecord(SET_OPERATION, pos, text);
+    CommitIfDue(lock, buffer_.size() - size, 1);
+}
+
+void EditJournal::LogSets(const std::vector<std::pair<Position, std::string_view>>& edits) {
+    if (edits.empty()) {
+        return;
+    }
+    std::unique_lock lock(mutex_);
+    size_t size = buffer_.size();
+    for (const auto& [pos, text] : edits) {
+        AppendRecord(SET_OPERATION, pos, text);
+    }
+    CommitIfDue(lock, buffer_.size() - size, edits.size());
+}
+
+void EditJournal::LogClear(Position pos) {
+    std::unique_lock lock(mutex_);
+    size_t size = buffer_.size();
+    AppendRecord(CLEAR_OPERATION, pos, {});
+    CommitIfDue(lock, buffer_.size() - size, 1);
+}
+
+void EditJournal::LogClears(const std::vector<Position>& positions) {
+    if (positions.empty()) {
+        return;
+    }
+    std::unique_lock lock(mutex_);
+    size_t size = buffer_.size();
+    for (auto pos : positions) {
+        AppendRecord(CLEAR_OPERATION, pos, {});
+    }
+    CommitIfDue(lock, buffer_.size() - size, positions.size());
+}
+
+void EditJournal::AppendRecord(char operation, Position pos, std::string_view text) {
+    size_t record_offset = buffer_.size();
+    buffer_ += operation;
+    AppendNumber(buffer_, static_cast<int32_t>(pos.row));
+    AppendNumber(buffer_, static_cast<int32_t>(pos.col));
+    AppendNumber(buffer_, static_cast<uint32_t>(text.size()));
+    buffer_ += text;
+    AppendNumber(buffer_, Checksum(std::string_view(buffer_).substr(record_offset)));
+
+    if (pending_count_++ == 0) {
+        first_pending_time_ = std::chrono::steady_clock::now();
+        pending_condition_.notify_one();
+    }
+}
+
+void EditJournal::CommitIfDue(std::unique_lock<std::mutex>& lock, size_t size, size_t count) {
+    auto now = std::chrono::steady_clock::now();
+    if (pending_count_ < options_.max_pending_edits && now - first_pending_time_ < options_.max_delay) {
+        return;
+    }
+    try {
+        CommitPending(lock);
+    } catch (const std::runtime_error&) {
+        // the caller doesn't apply the edits, so they must not be committed later.
+        // They are still the last ones pending, as only the caller logs edits
+        buffer_.resize(buffer_.size() - size);
+        pending_count_ -= count;
+        throw;
+    }
+}
+
+void EditJournal::Commit() {
+    std::unique_lock lock(mutex_);
+    CommitPending(lock);
+}
+
+void EditJournal::CommitPending(std::unique_lock<std::mutex>& lock) {
+    commit_condition_.wait(lock, [this] {
+        return !is_committing_;
+    });
+    if (pending_count_ == 0) {
+        return;
+    }
+
+    // edits are logged while the group is written and synced
+    std::string group;
+    group.swap(buffer_);
+    const size_t group_count = pending_count_;
+    const auto group_time = first_pending_time_;
+    pending_count_ = 0;
+    const size_t committed_size = committed_size_;
+    const bool is_torn = is_torn_;
+    is_committing_ = true;
+    lock.unlock();
+
+    bool is_writing = false;
+    try {
+        // bytes of a failed write are cut, so records are not written twice
+        if (is_torn) {
+            std::filesystem::resize_file(path_, committed_size);
+            // a journal started over is not opened for appending
+            if (std::fseek(file_, static_cast<long>(committed_size), SEEK_SET) != 0) {
+                throw std::runtime_error("Can't write " + path_);
+            }
+        }
+        is_writing = true;
+        WriteAll(file_, group, path_);
+        Sync(file_);
+    } catch (...) {
+        lock.lock();
+        is_torn_ = is_torn_ || is_writing;
+        group += buffer_;
+        buffer_ = std::move(group);
+        if (pending_count_ == 0) {
+            first_pending_time_ = group_time;
+        } else {
+            first_pending_time_ = std::min(first_pending_time_, group_time);
+        }
+        pending_count_ += group_count;
+        is_committing_ = false;
+        commit_condition_.notify_all();
+        throw;
+    }
+
+    lock.lock();
+    committed_size_ = committed_size + group.size();
+    is_torn_ = false;
+    is_committing_ = false;
+    commit_condition_.notify_all();
+}
+
+size_t EditJournal::GetPendingCount() const {
+    std::lock_guard lock(mutex_);
+    return pending_count_;
+}
+
+void EditJournal::Checkpoint(const Sheet& sheet, const std::string& snapshot_path) {
+    std::ostringstream snapshot;
+    sheet.SaveSnapshot(snapshot);
+
+    const std::string temp_path = snapshot_path + ".tmp";
+    std::FILE* file = std::fopen(temp_path.c_str(), "wb");
+    if (file == nullptr) {
+        throw std::runtime_error("Can't open " + temp_path);
+    }
+    try {
+        WriteAll(file, snapshot.str(), temp_path);
+        Sync(file);
+    } catch (...) {
+        std::fclose(file);
+        throw;
+    }
+    std::fclose(file);
+    std::filesystem::rename(temp_path, snapshot_path);
+    // the journal may only be started over when the new snapshot survives a crash
+    SyncDirectory(snapshot_path);
+
+    // pending edits are in the snapshot too
+    std::unique_lock lock(mutex_);
+    commit_condition_.wait(lock, [this] {
+        return !is_committing_;
+    });
+    buffer_.clear();
+    pending_count_ = 0;
+    std::fclose(file_);
+    file_ = nullptr;
+    Reset();
+}
+
+void EditJournal::Reset() {
+    file_ = std::fopen(path_.c_str(), "wb");
+    if (file_ == nullptr) {
+        throw std::runtime_error("Can't open " + path_);
+    }
+    std::setvbuf(file_, nullptr, _IONBF, 0);
+    const auto header = MakeHeader();
+    WriteAll(file_, header, path_);
+    Sync(file_);
+    committed_size_ = header.size();
+    is_torn_ = false;
+}
+
+size_t ReplayJournal(Sheet& sheet, const std::string& path) {
+    MappedFile file(path);
+
+    // the last edit of each position, nothing for clears
+    std::unordered_map<Position, std::optional<std::string_view>, PositionHasher> last_edits;
+    size_t count = 0;
+    ForEachRecord(file.GetData(), path, [&](const JournalRecord& record) {
+        if (record.operation == SET_OPERATION) {
+            last_edits[record.pos] = record.text;
+        } else {
+            last_edits[record.pos] = std::nullopt;
+        }
+        ++count;
+    });
+
+    // clears and sets only invalidate formulas, everything is calculated once in the end
+    auto mode = sheet.GetEvaluationMode();
+    sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+    std::vector<std::pair<Position, std::string>> sets;
+    for (const auto& [pos, text] : last_edits) {
+        if (text) {
+            sets.emplace_back(pos, std::string(*text));
+        } else if (pos.IsValid()) {
+            sheet.ClearCell(pos);
+        }
+    }
+    sheet.SetCells(std::move(sets));
+    sheet.SetEvaluationMode(mode);
+    return count;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include "common.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+class Sheet;
+
+struct JournalOptions {
+    // pending edits are committed when there are that many of them
+    size_t max_pending_edits = 1024;
+    // or when the oldest of them waits that long, whether more edits come or not
+    std::chrono::milliseconds max_delay{10};
+};
+
+// Append-only log of cell edits for recovery after a crash. Edits are collected
+// in memory and written with a single fsync per group (group commit), so an edit
+// is durable once Commit() returns, whether it was called explicitly, by the edit
+// filling the group or by the background thread committing groups that are due.
+// A crash loses at most the edits logged within max_delay before it, plus the time
+// of the fsync. Methods may be called by one thread at a time, the background
+// thread doesn't block edits while it writes a group.
+class EditJournal {
+public:
+    // Opens the journal appending to path, a new file is created if there's none.
+    // Throws std::runtime_error if the file can't be opened or is not a journal
+    explicit EditJournal(std::string path, JournalOptions options = {});
+    // Commits pending edits
+    ~EditJournal();
+
+    EditJournal(const EditJournal&) = delete;
+    EditJournal& operator=(const EditJournal&) = delete;
+
+    // Log edits before they are applied. An edit is not logged if committing the
+    // group it fills throws, so it may be skipped as well
+    void LogSet(Position pos, std::string_view text);
+    // Logs edits applied together, none of them if committing throws
+    void LogSets(const std::vector<std::pair<Position, std::string_view>>& edits);
+    void LogClear(Position pos);
+    void LogClears(const std::vector<Position>& positions);
+
+    // Writes pending edits and waits until they are on the disk
+    void Commit();
+    size_t GetPendingCount() const;
+
+    // Saves a snapshot of the sheet to snapshot_path and starts the journal over, as
+    // all edits logged so far are in the snapshot. The snapshot replaces the old one
+    // only when it's on the disk, so a crash leaves either the old snapshot with the
+    // whole journal or the new one, with edits of the journal already applied
+    void Checkpoint(const Sheet& sheet, const std::string& snapshot_path);
+
+private:
+    void AppendRecord(char operation, Position pos, std::string_view text);
+    // Commits if the group is full or due. If it fails, the last count records of
+    // size bytes are dropped before rethrowing
+    void CommitIfDue(std::unique_lock<std::mutex>& lock, size_t size, size_t count);
+    // Same as Commit() with mutex_ locked, which is released while the group is
+    // written and synced
+    void CommitPending(std::unique_lock<std::mutex>& lock);
+    // Truncates the file to an empty journal
+    void Reset();
+    // Body of committer_, commits pending edits when the oldest of them is due
+    void RunCommitter();
+
+    std::string path_;
+    JournalOptions options_;
+    std::FILE* file_ = nullptr;
+
+    // guards the file and pending edits shared with committer_
+    mutable std::mutex mutex_;
+    // notified when the first edit is pending and when the journal is closed
+    std::condition_variable pending_condition_;
+    bool is_closing_ = false;
+    // notified when a group is written, one group is written at a time
+    std::condition_variable commit_condition_;
+    bool is_committing_ = false;
+    // size of the file with all committed groups. If writing a group fails, the
+    // file is torn and cut to that size before the group is written again
+    size_t committed_size_ = 0;
+    bool is_torn_ = false;
+
+    std::string buffer_;
+    size_t pending_count_ = 0;
+    std::chrono::steady_clock::time_point first_pending_time_;
+
+    std::thread committer_;
+};
+
+// Applies edits of the journal at path to the sheet, usually just loaded from the
+// snapshot of the last checkpoint. Only the last edit of each position is applied,
+// all of them at once with formulas recalculated in the end. A record torn by a crash
+// at the end of the journal is ignored, so is a header torn while the journal was
+// started over. The sheet is expected to have no journal set,
+// see Sheet::SetJournal(). Returns the number of edits read, throws std::runtime_error
+// if the file is not a journal
+size_t ReplayJournal(Sheet& sheet, const std::string& path);
@@ -1,7 +1,22 @@
 #include "common.h"
 #include "formula.h"
+#include "FormulaAST.h"
+#include "journal.h"
+#include "sheet.h"
+#include "sheet_io.h"
 #include "test_runner_p.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <fstream>
+#include <mutex>
+#include <optional>
+#include <random>
+#include <sstream>
+#include <thread>
+
 inline std::ostream& operator<<(std::ostream& output, Position pos) {
     return output << "(" << pos.row << ", " << pos.col << ")";
 }
@@ -347,6 +362,1210 @@ namespace {
         ASSERT(caught);
         ASSERT_EQUAL(sheet->GetCell("M6"_pos)->GetText(), "Ready");
     }
+
+    void TestDiamondRecalculation() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "1");
+
+        std::string total = "=0";
+        for (int row = 0; row < 50; ++row) {
+            Position pos{row, 1};
+            sheet->SetCell(pos, "=A1*" + std::to_string(row + 1));
+            total += "+" + pos.ToString();
+        }
+        sheet->SetCell("C1"_pos, total);
+        sheet->SetCell("D1"_pos, "=C1+A1");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(1275.0));
+
+        sheet->SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("B50"_pos)->GetValue(), CellInterface::Value(100.0));
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(2550.0));
+        ASSERT_EQUAL(sheet->GetCell("D1"_pos)->GetValue(), CellInterface::Value(2552.0));
+    }
+
+    void TestClearReferencedCell() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "=B1");
+        sheet->SetCell("B1"_pos, "=C1+1");
+        sheet->SetCell("C1"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+
+        sheet->ClearCell("B1"_pos);
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+        // C1 does not feed B1 anymore, B1 still feeds A1
+        sheet->SetCell("C1"_pos, "5");
+        sheet->SetCell("B1"_pos, "7");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(7.0));
+    }
+
+    void TestLazyEvaluation() {
+        Sheet sheet;
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+
+        sheet.SetCell("A1"_pos, "=B1+C1");
+        sheet.SetCell("B1"_pos, "=C1*2");
+        sheet.SetCell("C1"_pos, "1");
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+
+        sheet.SetCell("C1"_pos, "2");
+        sheet.SetCell("C1"_pos, "3");
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(9.0));
+
+        sheet.SetCell("C1"_pos, "x");
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(),
+                     CellInterface::Value(FormulaError::Category::Value));
+
+        sheet.ClearCell("C1"_pos);
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(0.0));
+    }
+
+    void TestLazyEvaluationLongChain() {
+        Sheet sheet;
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+
+        const int length = 2000;
+        sheet.SetCell(Position{0, 0}, "1");
+        for (int row = 1; row < length; ++row) {
+            sheet.SetCell(Position{row, 0}, "=" + Position{row - 1, 0}.ToString() + "+1");
+        }
+        ASSERT_EQUAL(sheet.GetCell(Position{length - 1, 0})->GetValue(),
+                     CellInterface::Value(double(length)));
+
+        sheet.SetCell(Position{0, 0}, "2");
+        ASSERT_EQUAL(sheet.GetCell(Position{length - 1, 0})->GetValue(),
+                     CellInterface::Value(double(length + 1)));
+    }
+
+    void TestCircularReferencesInDeepChain() {
+        Sheet sheet;
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        const int length = 16000;
+
+        // built from the top, so every formula references a cell created after it
+        for (int row = 0; row + 1 < length; ++row) {
+            sheet.SetCell(Position{row, 0}, "=" + Position{row + 1, 0}.ToString() + "+1");
+        }
+        sheet.SetCell(Position{length - 1, 0}, "=B1");
+        sheet.SetCell("B1"_pos, "1");
+        ASSERT_EQUAL(sheet.GetCell("A1"_pos)->GetValue(), CellInterface::Value(double(length)));
+
+        auto is_circular = [&](Position pos, std::string text) {
+            try {
+                sheet.SetCell(pos, std::move(text));
+            } catch (const CircularDependencyException&) {
+                return true;
+            }
+            return false;
+        };
+
+        ASSERT(is_circular("B1"_pos, "=A1"));
+        ASSERT(is_circular("B1"_pos, "=C1+A10000"));
+        ASSERT(is_circular(Position{length - 1, 0}, "=A1"));
+        ASSERT(is_circular("A5"_pos, "=A5"));
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "1");
+
+        // reversing part of the chain is fine once it's cut
+        ASSERT(!is_circular("A100"_pos, "=C1"));
+        ASSERT(!is_circular("A200"_pos, "=A5"));
+        ASSERT(is_circular("C1"_pos, "=A150"));
+        ASSERT(!is_circular("C1"_pos, "=A250"));
+        ASSERT_EQUAL(std::get<double>(sheet.GetCell("A1"_pos)->GetValue()),
+                     std::get<double>(sheet.GetCell("A250"_pos)->GetValue()) + 99);
+    }
+
+    void TestFormulaCache() {
+        FormulaCache cache(2);
+
+        auto first = cache.Parse("A1 + 1");
+        ASSERT_EQUAL(first->GetExpression(), "A1+1");
+        ASSERT(cache.Parse("A1 + 1") == first);
+        ASSERT(cache.Parse("A1+1") != first);
+        ASSERT_EQUAL(cache.GetSize(), 2u);
+
+        try {
+            cache.Parse("A1+");
+            ASSERT(false);
+        } catch (const FormulaException&) {
+        }
+        ASSERT_EQUAL(cache.GetSize(), 2u);
+
+        // "A1 + 1" was used last, so "A1+1" is evicted
+        cache.Parse("A1 + 1");
+        cache.Parse("B2");
+        ASSERT_EQUAL(cache.GetSize(), 2u);
+        ASSERT(cache.Parse("A1 + 1") == first);
+
+        auto sheet = CreateSheet();
+        sheet->SetCell("B1"_pos, "=A1 + 1");
+        sheet->SetCell("B2"_pos, "=A1 + 1");
+        sheet->SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT_EQUAL(sheet->GetCell("B2"_pos)->GetText(), "=A1+1");
+    }
+
+    void TestDescentParserMatchesAntlr() {
+        // prints tree, formula and cells of the AST or nothing if the expression is rejected
+        auto describe = [](auto&& parse) -> std::optional<std::string> {
+            try {
+                FormulaAST ast = parse();
+                std::ostringstream out;
+                ast.Print(out);
+                out << " | ";
+                ast.PrintFormula(out);
+                out << " | ";
+                ast.PrintCells(out);
+                return out.str();
+            } catch (const std::exception&) {
+                return std::nullopt;
+            }
+        };
+
+        auto check = [&](const std::string& expression) {
+            auto antlr = describe([&] {
+                std::istringstream in(expression);
+                return ParseFormulaAST(in);
+            });
+            auto descent = describe([&] {
+                return ParseFormulaAST(std::string_view(expression));
+            });
+            AssertEqual(antlr.value_or("<error>"), descent.value_or("<error>"), "expression: " + expression);
+        };
+
+        for (const char* expression : {
+                 "1", " 42 ", "2+2*2", "(2+3)*4", "-1", "+-+1", "-2*3", "2*-3*4", "-(1+2)", "1-2-3",
+                 "8/4/2", "1-(2-3)", "A1", "A1+B2*C3", "ZZ99/(A1-A1)", "1.5", ".5", "1e5", "1E+5",
+                 "2.5e-3", "1e400", "1e-400", "1.", "1e", "1e+", "A01", "AAAA1", "A0", "X0", "R2D2",
+                 "A1B", "a1", "", "()", "(1", "1)", "1 2", "A1 A2", "1+", "*1", "1..2", "1.2.3", "\t1\n+\r2",
+                 "1$", "A1:B2", "12EA1", "2EA1", "1E5E5", "SUM(A1:B2)", "MIN()", "MAX(1,2,A1)",
+                 "COUNT(A1:A1,B2:A1)", "AVERAGE((A1))", "-SUM(1)*2", "SUM(SUM(A1:A2)/2,B1:B2)", "SUM",
+                 "SUM (1)", "SUM(A1:B2+1)", "SUM(A1:)", "SUM(:B2)", "SUM(1,)", "SUM(,1)", "FOO(1)",
+                 "sum(1)", "SUM(A1:B2:C3)", "SUM((A1:B2))", "MAX(ZZZZ1:A1)", "SUM(A1)(1)"}) {
+            check(expression);
+        }
+
+        // random strings over the alphabet of the grammar
+        std::mt19937 generator(17);
+        const std::string alphabet = "AZ0159.eE+-*/() ,:";
+        for (int i = 0; i < 20000; ++i) {
+            std::string expression(generator() % 12, ' ');
+            for (char& c : expression) {
+                c = alphabet[generator() % alphabet.size()];
+            }
+            check(expression);
+        }
+    }
+
+    void TestFormulaDeepNesting() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "2");
+
+        // right-nested operations need a deep evaluation stack
+        std::string expression = "A1";
+        for (int i = 0; i < 100; ++i) {
+            expression = "1-(" + expression + "*1)";
+        }
+        sheet->SetCell("B1"_pos, "=" + expression);
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+        ASSERT_EQUAL(std::get<double>(ParseFormula(expression)->Evaluate(*sheet)), 2.0);
+
+        sheet->SetCell("A1"_pos, "=1/0");
+        ASSERT_EQUAL(sheet->GetCell("B1"_pos)->GetValue(),
+                     CellInterface::Value(FormulaError::Category::Div0));
+    }
+
+    void TestSparseStorage() {
+        auto sheet = CreateSheet();
+        const Position far{Position::MAX_ROWS - 1, Position::MAX_COLS - 1};
+
+        sheet->SetCell(far, "=B2+1");
+        sheet->SetCell("P17"_pos, "x");
+        sheet->SetCell("Q16"_pos, "y");
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{Position::MAX_ROWS, Position::MAX_COLS}));
+        ASSERT_EQUAL(sheet->GetCell(far)->GetValue(), CellInterface::Value(1.0));
+        ASSERT(sheet->GetCell("Q17"_pos) == nullptr);
+
+        sheet->ClearCell(far);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{17, 17}));
+        ASSERT(sheet->GetCell(far) == nullptr);
+
+        sheet->ClearCell("Q16"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{17, 16}));
+
+        sheet->ClearCell("P17"_pos);
+        sheet->ClearCell("B2"_pos);
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{0, 0}));
+        std::ostringstream texts;
+        sheet->PrintTexts(texts);
+        ASSERT_EQUAL(texts.str(), "");
+    }
+
+    void TestFormulaRanges() {
+        auto sheet = CreateSheet();
+        auto value = [&sheet](std::string_view pos) {
+            return sheet->GetCell(Position::FromString(pos))->GetValue();
+        };
+
+        sheet->SetCell("A1"_pos, "1");
+        sheet->SetCell("A2"_pos, "=A1*2");
+        sheet->SetCell("A3"_pos, "text");
+        sheet->SetCell("B1"_pos, "'");
+        sheet->SetCell("B3"_pos, "'6");
+        sheet->SetCell("C1"_pos, "=SUM( B3 : A1 , 10)");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetText(), "=SUM(A1:B3,10)");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetReferencedCells(),
+                     (std::vector{"A1"_pos, "B1"_pos, "A2"_pos, "B2"_pos, "A3"_pos, "B3"_pos}));
+
+        // empty cells and text which is not a number are skipped
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(19.0));
+        sheet->SetCell("C2"_pos, "=COUNT(A1:B3)+AVERAGE(A1:B3)");
+        ASSERT_EQUAL(value("C2"), CellInterface::Value(6.0));
+        sheet->SetCell("C3"_pos, "=MIN(A1:B3)*100+MAX(A1:A3,-SUM(7))");
+        ASSERT_EQUAL(value("C3"), CellInterface::Value(102.0));
+        sheet->SetCell("C4"_pos, "=AVERAGE(D1:D1000)");
+        ASSERT_EQUAL(value("C4"), CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+        sheet->SetCell("C5"_pos, "=MAX(D1:D10)+COUNT()+SUM()");
+        ASSERT_EQUAL(value("C5"), CellInterface::Value(0.0));
+
+        // changes inside the range are propagated, errors too
+        sheet->SetCell("B2"_pos, "=1/0");
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+        sheet->SetCell("B2"_pos, "100");
+        ASSERT_EQUAL(value("C1"), CellInterface::Value(119.0));
+        ASSERT_EQUAL(value("C3"), CellInterface::Value(102.0));
+
+        // a range covering the cell itself is a cycle
+        try {
+            sheet->SetCell("B2"_pos, "=SUM(A1:C1)");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+        for (const char* formula : {"=A1:B2", "=SUM(A1:B2", "=SUM(A1:B2:C3)", "=FOO(1)", "=SUM(1,)",
+                                    "=SUM(A1:ZZZZ1)", "=sum(1)"}) {
+            try {
+                sheet->SetCell("E1"_pos, formula);
+                ASSERT(false);
+            } catch (const FormulaException&) {
+            }
+        }
+
+        // the same values are seen by formulas evaluated against the sheet interface
+        auto formula = ParseFormula("SUM(A1:B3)+COUNT(A1:B3)+MAX(A1:B3)");
+        ASSERT_EQUAL(std::get<double>(formula->Evaluate(*sheet)), 213.0);
+    }
+
+    void TestFormulaRangesLazy() {
+        auto sheet = std::make_unique<Sheet>();
+        sheet->SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        for (int row = 0; row < 100; ++row) {
+            sheet->SetCell(Position{row, 0}, std::to_string(row + 1));
+            sheet->SetCell(Position{row, 1}, row == 0 ? "=A1" : "=B" + std::to_string(row) + "+A" + std::to_string(row + 1));
+        }
+        sheet->SetCell("C1"_pos, "=SUM(B1:B100)");
+        sheet->SetCell("C2"_pos, "=MAX(A1:B100)/COUNT(A1:B100)");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(171700.0));
+        ASSERT_EQUAL(sheet->GetCell("C2"_pos)->GetValue(), CellInterface::Value(25.25));
+
+        sheet->SetCell("A1"_pos, "101");
+        ASSERT_EQUAL(sheet->GetCell("C1"_pos)->GetValue(), CellInterface::Value(181700.0));
+        ASSERT_EQUAL(sheet->GetCell("C2"_pos)->GetValue(), CellInterface::Value(25.75));
+    }
+
+    void TestRangeDependencies() {
+        auto sheet = CreateSheet();
+        // the whole sheet but the column A, no cells are created for the range
+        sheet->SetCell("A1"_pos, "=SUM(B1:XFD16384)+COUNT(B1:XFD16384)");
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{1, 1}));
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(0.0));
+
+        // referenced positions are visible as empty cells
+        const CellInterface* referenced = sheet->GetCell("XFD16384"_pos);
+        ASSERT(referenced != nullptr);
+        ASSERT_EQUAL(referenced->GetText(), "");
+        ASSERT_EQUAL(referenced->GetValue(), CellInterface::Value(""));
+        ASSERT(sheet->GetCell("A2"_pos) == nullptr);
+
+        sheet->SetCell("Z100"_pos, "5");
+        sheet->SetCell("C3"_pos, "=Z100*2+A2");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(17.0));
+        sheet->SetCell("A2"_pos, "1");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(18.0));
+
+        try {
+            sheet->SetCell("D4"_pos, "=A1");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+        ASSERT(sheet->GetCell("D4"_pos) != nullptr);
+        ASSERT_EQUAL(sheet->GetCell("D4"_pos)->GetText(), "");
+
+        // a cell created after the formula referencing it is ordered before the formula
+        sheet->SetCell("B1"_pos, "=A2*100");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(119.0));
+        sheet->SetCell("A2"_pos, "2");
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(220.0));
+
+        sheet->ClearCell("Z100"_pos);
+        sheet->ClearCell("B1"_pos);
+        ASSERT_EQUAL(sheet->GetCell("A1"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT_EQUAL(sheet->GetPrintableSize(), (Size{3, 3}));
+
+        // replaced formula drops its references
+        sheet->SetCell("A1"_pos, "=B2");
+        ASSERT(sheet->GetCell("XFD16384"_pos) == nullptr);
+        sheet->SetCell("D4"_pos, "=A1");
+        ASSERT_EQUAL(sheet->GetCell("D4"_pos)->GetValue(), CellInterface::Value(0.0));
+    }
+
+    void TestParallelRecalculation() {
+        // fans, chains and ranges mixed, so levels have very different widths
+        auto fill = [](Sheet& sheet) {
+            for (int row = 0; row < 1000; ++row) {
+                std::string r = std::to_string(row + 1);
+                sheet.SetCell(Position{row, 1}, "=A1*" + r + "/7");
+                sheet.SetCell(Position{row, 2}, row == 0 ? "=B1" : "=C" + std::to_string(row) + "+B" + r);
+                sheet.SetCell(Position{row, 3}, "=SUM(B1:B" + r + ")-C" + r);
+                sheet.SetCell(Position{row, 4}, "=D" + r + "/(A2-" + std::to_string(row % 3) + ")");
+            }
+            sheet.SetCell("F1"_pos, "=MAX(B1:E1000)+COUNT(B1:E1000)");
+        };
+
+        Sheet serial;
+        Sheet parallel;
+        parallel.SetThreadCount(4);
+        ASSERT_EQUAL(parallel.GetThreadCount(), size_t(4));
+        fill(serial);
+        fill(parallel);
+
+        for (const char* a1 : {"1", "3.5", "=1/0", "text", "-2"}) {
+            for (const char* a2 : {"0", "1", "2.5"}) {
+                for (Sheet* sheet : {&serial, &parallel}) {
+                    sheet->SetCell("A1"_pos, a1);
+                    sheet->SetCell("A2"_pos, a2);
+                }
+                for (int row = 0; row < 1000; ++row) {
+                    for (int col = 1; col <= 4; ++col) {
+                        ASSERT_EQUAL(serial.GetCell(Position{row, col})->GetValue(),
+                                     parallel.GetCell(Position{row, col})->GetValue());
+                    }
+                }
+                ASSERT_EQUAL(serial.GetCell("F1"_pos)->GetValue(), parallel.GetCell("F1"_pos)->GetValue());
+            }
+        }
+
+        parallel.SetThreadCount(1);
+        ASSERT_EQUAL(parallel.GetThreadCount(), size_t(1));
+        parallel.SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(parallel.GetCell("B7"_pos)->GetValue(), CellInterface::Value(2.0));
+
+        // formulas left dirty in Lazy mode are calculated when going back to Eager
+        parallel.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        parallel.SetCell("A1"_pos, "7");
+        parallel.SetThreadCount(3);
+        parallel.SetEvaluationMode(Sheet::EvaluationMode::Eager);
+        parallel.SetCell("A2"_pos, "5");
+        serial.SetCell("A1"_pos, "7");
+        serial.SetCell("A2"_pos, "5");
+        ASSERT_EQUAL(serial.GetCell("F1"_pos)->GetValue(), parallel.GetCell("F1"_pos)->GetValue());
+        ASSERT_EQUAL(serial.GetCell("E1000"_pos)->GetValue(), parallel.GetCell("E1000"_pos)->GetValue());
+    }
+
+    void TestCellRecordsReuse() {
+        auto sheet = CreateSheet();
+        sheet->SetCell("A1"_pos, "'=text");
+        sheet->SetCell("B1"_pos, "=A2*2");
+        sheet->SetCell("A2"_pos, "21");
+        const CellInterface* cleared = sheet->GetCell("A1"_pos);
+        ASSERT_EQUAL(cleared->GetValue(), CellInterface::Value("=text"));
+        ASSERT_EQUAL(cleared->GetText(), "'=text");
+
+        // the record of a cleared cell is taken by the next new one
+        sheet->ClearCell("A1"_pos);
+        sheet->SetCell("C3"_pos, "=B1+A2");
+        ASSERT(sheet->GetCell("C3"_pos) == cleared);
+        ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetValue(), CellInterface::Value(63.0));
+        ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetText(), "=B1+A2");
+        ASSERT(sheet->GetCell("A1"_pos) == nullptr);
+
+        // a cell switching kinds drops the state of the previous one
+        sheet->SetCell("B1"_pos, "text");
+        ASSERT(sheet->GetCell("B1"_pos)->GetReferencedCells().empty());
+        ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetValue(),
+                     CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+        sheet->SetCell("B1"_pos, "=A2");
+        ASSERT_EQUAL(sheet->GetCell("C3"_pos)->GetValue(), CellInterface::Value(42.0));
+
+        for (int row = 0; row < 3000; ++row) {
+            sheet->SetCell(Position{row, 5}, "=A2+" + std::to_string(row));
+        }
+        for (int row = 0; row < 3000; row += 2) {
+            sheet->ClearCell(Position{row, 5});
+        }
+        ASSERT_EQUAL(sheet->GetCell(Position{2999, 5})->GetValue(), CellInterface::Value(3020.0));
+        ASSERT(sheet->GetCell(Position{2998, 5}) == nullptr);
+    }
+    void TestParallelIrregularGraphs() {
+        Sheet sheet;
+        sheet.SetThreadCount(4);
+        // lattice of averages is exactly A1 everywhere, a chain is A1 + length
+        for (int row = 0; row < 40; ++row) {
+            for (int col = 1; col <= 40; ++col) {
+                std::string up = row == 0 ? "A1" : Position{row - 1, col}.ToString();
+                std::string left = col == 1 ? "A1" : Position{row, col - 1}.ToString();
+                sheet.SetCell(Position{row, col}, "=(" + up + "+" + left + ")/2");
+            }
+        }
+        sheet.SetCell(Position{0, 50}, "=A1+1");
+        for (int row = 1; row < 600; ++row) {
+            sheet.SetCell(Position{row, 50}, "=" + Position{row - 1, 50}.ToString() + "+1");
+        }
+
+        for (double a1 : {4.0, -0.5, 1024.0}) {
+            sheet.SetCell("A1"_pos, "=" + std::to_string(a1));
+            for (int row = 0; row < 40; ++row) {
+                for (int col = 1; col <= 40; ++col) {
+                    ASSERT_EQUAL(sheet.GetCell(Position{row, col})->GetValue(), CellInterface::Value(a1));
+                }
+            }
+            ASSERT_EQUAL(sheet.GetCell(Position{599, 50})->GetValue(), CellInterface::Value(a1 + 600));
+        }
+
+        sheet.SetCell("A1"_pos, "=1/0");
+        ASSERT_EQUAL(sheet.GetCell(Position{39, 40})->GetValue(),
+                     CellInterface::Value(FormulaError(FormulaError::Category::Div0)));
+    }
+    void TestSetCells() {
+        using Reason = Sheet::CellError::Reason;
+
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "=A1+1");
+
+        auto errors = sheet.SetCells({
+                {"C1"_pos, "=B1*2"},
+                {"A1"_pos, "5"},
+                {"A2"_pos, "=A1+C2"},
+                {"D1"_pos, "=E1"},
+                {"E1"_pos, "=D1"},
+                {Position{-1, 0}, "1"},
+                {"F1"_pos, "=1+"},
+                {"G1"_pos, "=1"},
+                {"G1"_pos, "=2"},
+                {"H1"_pos, "=H1"},
+                {"B1"_pos, "=C1"},
+                {"C2"_pos, "=A1*3"},
+        });
+
+        std::vector<std::pair<size_t, Reason>> expected_errors = {
+                {0, Reason::CircularDependency},
+                {3, Reason::CircularDependency},
+                {4, Reason::CircularDependency},
+                {5, Reason::InvalidPosition},
+                {6, Reason::InvalidFormula},
+                {9, Reason::CircularDependency},
+                {10, Reason::CircularDependency},
+        };
+        ASSERT_EQUAL(errors.size(), expected_errors.size());
+        for (size_t i = 0; i < errors.size(); ++i) {
+            ASSERT_EQUAL(errors[i].index, expected_errors[i].first);
+            ASSERT(errors[i].reason == expected_errors[i].second);
+        }
+        ASSERT_EQUAL(errors[1].pos, "D1"_pos);
+
+        // rejected edits leave cells as they were
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetText(), "=A1+1");
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+        ASSERT(sheet.GetCell("C1"_pos) == nullptr);
+        ASSERT(sheet.GetCell("D1"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(20.0));
+        ASSERT_EQUAL(sheet.GetCell("G1"_pos)->GetText(), "=2");
+        ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{2, 7}));
+
+        // an edit replaced by one closing a cycle is kept, as with SetCell() in order
+        errors = sheet.SetCells({
+                {"J1"_pos, "5"},
+                {"J1"_pos, "=J1"},
+                {"K1"_pos, "1"},
+                {"K1"_pos, "=J1*2"},
+                {"K1"_pos, "=K1+1"},
+        });
+        ASSERT_EQUAL(errors.size(), 2u);
+        ASSERT_EQUAL(errors[0].index, 1u);
+        ASSERT_EQUAL(errors[1].index, 4u);
+        ASSERT_EQUAL(sheet.GetCell("J1"_pos)->GetText(), "5");
+        ASSERT_EQUAL(sheet.GetCell("K1"_pos)->GetText(), "=J1*2");
+        ASSERT_EQUAL(sheet.GetCell("K1"_pos)->GetValue(), CellInterface::Value(10.0));
+        sheet.ClearCell("K1"_pos);
+        sheet.ClearCell("J1"_pos);
+
+        // the order of cells stays usable for single edits
+        sheet.SetCell("A1"_pos, "2");
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetValue(), CellInterface::Value(8.0));
+        try {
+            sheet.SetCell("A1"_pos, "=A2");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+
+        // dependents loaded before the cells they reference, same result as one by one
+        std::vector<std::pair<Position, std::string>> edits;
+        for (int row = 199; row >= 0; --row) {
+            std::string r = std::to_string(row + 1);
+            edits.emplace_back(Position{row, 1}, row == 0 ? "=A1" : "=B" + std::to_string(row) + "+A" + r);
+            edits.emplace_back(Position{row, 2}, "=SUM(B1:B" + r + ")");
+            edits.emplace_back(Position{row, 0}, std::to_string(row % 7));
+        }
+        for (auto mode : {Sheet::EvaluationMode::Eager, Sheet::EvaluationMode::Lazy}) {
+            Sheet bulk;
+            Sheet serial;
+            bulk.SetEvaluationMode(mode);
+            ASSERT(bulk.SetCells(edits).empty());
+            for (const auto& [pos, text] : edits) {
+                serial.SetCell(pos, text);
+            }
+            for (int i = 0; i < 2; ++i) {
+                for (int row = 0; row < 200; ++row) {
+                    for (int col = 0; col < 3; ++col) {
+                        ASSERT_EQUAL(bulk.GetCell(Position{row, col})->GetValue(),
+                                     serial.GetCell(Position{row, col})->GetValue());
+                    }
+                }
+                bulk.SetCells({{"A1"_pos, "100"}, {"A200"_pos, "=1/0"}});
+                serial.SetCell("A1"_pos, "100");
+                serial.SetCell("A200"_pos, "=1/0");
+            }
+        }
+    }
+    void TestImportTexts() {
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "=B2*2");
+        sheet.SetCell("B2"_pos, "'=text");
+        sheet.SetCell("C2"_pos, "=SUM(A1:B2)");
+        sheet.SetCell("D4"_pos, "4.5");
+        std::ostringstream texts;
+        sheet.PrintTexts(texts);
+
+        Sheet imported;
+        imported.SetCell("E1"_pos, "kept");
+        ASSERT(ImportTexts(imported, texts.str()).empty());
+        ASSERT_EQUAL(imported.GetCell("E1"_pos)->GetText(), "kept");
+        imported.ClearCell("E1"_pos);
+        std::ostringstream imported_texts;
+        imported.PrintTexts(imported_texts);
+        ASSERT_EQUAL(imported_texts.str(), texts.str());
+        ASSERT_EQUAL(imported.GetCell("C2"_pos)->GetValue(), CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+
+        auto errors = ImportTexts(imported, "1,\"a,\"\"b\"\"\"\r\n=A1+,,=A1*3\n\"multi\nline\",\"ab\"cd", TextFormat::Csv);
+        ASSERT_EQUAL(errors.size(), size_t(1));
+        ASSERT_EQUAL(errors[0].index, size_t(2));
+        ASSERT_EQUAL(errors[0].pos, "A2"_pos);
+        ASSERT(errors[0].reason == Sheet::CellError::Reason::InvalidFormula);
+        ASSERT_EQUAL(imported.GetCell("B1"_pos)->GetText(), "a,\"b\"");
+        ASSERT_EQUAL(imported.GetCell("C2"_pos)->GetValue(), CellInterface::Value(3.0));
+        ASSERT_EQUAL(imported.GetCell("A3"_pos)->GetText(), "multi\nline");
+        ASSERT_EQUAL(imported.GetCell("B3"_pos)->GetText(), "abcd");
+        ASSERT(imported.GetCell("A2"_pos) == nullptr);
+
+        auto path = std::filesystem::temp_directory_path() / "spreadsheet_import_test.tsv";
+        {
+            std::ofstream file(path, std::ios::binary);
+            file << "1\t=A1+1\n\t=B1*A1\n";
+        }
+        Sheet from_file;
+        from_file.SetThreadCount(2);
+        ASSERT(ImportTextsFromFile(from_file, path.string()).empty());
+        ASSERT_EQUAL(from_file.GetCell("B2"_pos)->GetValue(), CellInterface::Value(2.0));
+        std::filesystem::remove(path);
+
+        try {
+            ImportTextsFromFile(from_file, path.string());
+            ASSERT(false);
+        } catch (const std::runtime_error&) {
+        }
+    }
+
+    void TestPrintRange() {
+        // reference output formatted cell by cell
+        auto print_values = [](const Sheet& sheet, CellRange range) {
+            std::ostringstream output;
+            for (int row = range.first.row; row <= range.last.row; ++row) {
+                for (int col = range.first.col; col <= range.last.col; ++col) {
+                    if (col > range.first.col) {
+                        output << '\t';
+                    }
+                    if (auto cell = sheet.GetCell(Position{row, col})) {
+                        output << cell->GetValue();
+                    }
+                }
+                output << '\n';
+            }
+            return output.str();
+        };
+
+        Sheet sheet;
+        sheet.SetCell("B2"_pos, "=1/3");
+        sheet.SetCell("C2"_pos, "=123456789*1000");
+        sheet.SetCell("D3"_pos, "'=text");
+        sheet.SetCell("B4"_pos, "=-0.000012345678");
+        sheet.SetCell("C4"_pos, "=1/0");
+
+        std::ostringstream values;
+        sheet.PrintValues(values, CellRange{"B2"_pos, "C4"_pos});
+        ASSERT_EQUAL(values.str(), "0.333333\t1.23457e+11\n\t\n-1.23457e-05\t#DIV/0!\n");
+        ASSERT_EQUAL(values.str(), print_values(sheet, CellRange{"B2"_pos, "C4"_pos}));
+
+        std::ostringstream texts;
+        sheet.PrintTexts(texts, CellRange{"C3"_pos, "E3"_pos});
+        ASSERT_EQUAL(texts.str(), "\t'=text\t\n");
+
+        try {
+            sheet.PrintValues(values, CellRange{"A1"_pos, Position{0, Position::MAX_COLS}});
+            ASSERT(false);
+        } catch (const InvalidPositionException&) {
+        }
+
+        // rows formatted in blocks by several threads come in order
+        Sheet large;
+        std::mt19937 generator(7);
+        for (int i = 0; i < 3000; ++i) {
+            Position pos{int(generator() % 400), int(generator() % 300)};
+            large.SetCell(pos, generator() % 2 ? std::to_string(generator() % 1000) : "=" + std::to_string(i) + "/7");
+        }
+        large.SetCell(Position{399, 299}, "last");
+        large.SetThreadCount(3);
+        large.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        large.SetCell("A1"_pos, "=B1+1");
+        std::ostringstream large_values;
+        large.PrintValues(large_values);
+        ASSERT_EQUAL(large_values.str(), print_values(large, CellRange{"A1"_pos, Position{399, 299}}));
+    }
+
+    void TestSnapshot() {
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "2");
+        sheet.SetCell("B1"_pos, "=A1*10");
+        sheet.SetCell("C1"_pos, "=A1*10");
+        sheet.SetCell("A2"_pos, "'=text");
+        sheet.SetCell("B2"_pos, "");
+        sheet.SetCell("C2"_pos, "=SUM(A1:C1)/(A1-2)");
+        sheet.SetCell("D3"_pos, "=C1+E5");
+
+        std::ostringstream snapshot;
+        sheet.SaveSnapshot(snapshot);
+
+        auto check_copy = [&sheet](Sheet& copy) {
+            ASSERT_EQUAL(copy.GetPrintableSize(), sheet.GetPrintableSize());
+            std::ostringstream texts;
+            std::ostringstream copy_texts;
+            sheet.PrintTexts(texts);
+            copy.PrintTexts(copy_texts);
+            ASSERT_EQUAL(copy_texts.str(), texts.str());
+            std::ostringstream values;
+            std::ostringstream copy_values;
+            sheet.PrintValues(values);
+            copy.PrintValues(copy_values);
+            ASSERT_EQUAL(copy_values.str(), values.str());
+        };
+
+        Sheet copy;
+        copy.SetThreadCount(2);
+        copy.LoadSnapshot(snapshot.str());
+        check_copy(copy);
+        ASSERT(copy.GetCell("E5"_pos) != nullptr);
+
+        // dependencies and order of cells are restored
+        copy.SetCell("A1"_pos, "3");
+        ASSERT_EQUAL(copy.GetCell("C2"_pos)->GetValue(), CellInterface::Value(63.0));
+        ASSERT_EQUAL(copy.GetCell("D3"_pos)->GetValue(), CellInterface::Value(30.0));
+        try {
+            copy.SetCell("A1"_pos, "=D3");
+            ASSERT(false);
+        } catch (const CircularDependencyException&) {
+        }
+
+        // formulas left dirty in Lazy mode stay dirty
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        sheet.SetCell("A1"_pos, "5");
+        std::ostringstream lazy_snapshot;
+        sheet.SaveSnapshot(lazy_snapshot);
+        Sheet lazy_copy;
+        lazy_copy.LoadSnapshot(lazy_snapshot.str());
+        ASSERT(lazy_copy.GetEvaluationMode() == Sheet::EvaluationMode::Lazy);
+        ASSERT(!lazy_copy.FindCell("B1"_pos)->IsCacheValid());
+        check_copy(lazy_copy);
+
+        auto path = std::filesystem::temp_directory_path() / "spreadsheet_snapshot_test.bin";
+        SaveSnapshotToFile(sheet, path.string());
+        Sheet from_file;
+        LoadSnapshotFromFile(from_file, path.string());
+        check_copy(from_file);
+        std::filesystem::remove(path);
+
+        auto expect_damaged = [](std::string data) {
+            Sheet damaged;
+            try {
+                damaged.LoadSnapshot(data);
+                ASSERT(false);
+            } catch (const SnapshotException&) {
+            }
+            ASSERT_EQUAL(damaged.GetPrintableSize(), (Size{0, 0}));
+            ASSERT(damaged.GetCell("A1"_pos) == nullptr);
+        };
+        auto data = snapshot.str();
+        expect_damaged(data.substr(0, data.size() / 2));
+        expect_damaged("not a snapshot");
+        auto version = data;
+        version[8] = 2;
+        expect_damaged(version);
+        // a formula ordered before a cell it references, orders are after row and col
+        auto order = data;
+        for (size_t record = 0; record < 7; ++record) {
+            std::fill_n(order.begin() + 48 + record * 40 + 8, 4, '\0');
+        }
+        expect_damaged(order);
+        // a text cell with the text of a formula, invalid and valid
+        for (auto text : {"=1+xx)", "=D3*10"}) {
+            auto formula_text = data;
+            formula_text.replace(formula_text.find("'=text"), 6, text);
+            expect_damaged(formula_text);
+        }
+
+        try {
+            copy.LoadSnapshot(data);
+            ASSERT(false);
+        } catch (const SnapshotException&) {
+        }
+    }
+
+    void TestEditJournal() {
+        auto directory = std::filesystem::temp_directory_path();
+        auto journal_path = (directory / "spreadsheet_test.journal").string();
+        auto snapshot_path = (directory / "spreadsheet_test.snapshot").string();
+        std::filesystem::remove(journal_path);
+        std::filesystem::remove(snapshot_path);
+
+        auto print = [](const Sheet& sheet) {
+            std::ostringstream output;
+            sheet.PrintTexts(output);
+            sheet.PrintValues(output);
+            return output.str();
+        };
+
+        Sheet sheet;
+        std::string expected;
+        {
+            EditJournal journal(journal_path, JournalOptions{3, std::chrono::hours(1)});
+            sheet.SetJournal(&journal);
+            sheet.SetCell("A1"_pos, "1");
+            sheet.SetCell("B1"_pos, "=A1+1");
+            ASSERT_EQUAL(journal.GetPendingCount(), size_t(2));
+            sheet.SetCell("C1"_pos, "=B1*2");
+            ASSERT_EQUAL(journal.GetPendingCount(), size_t(0));
+
+            // failed edits are not logged
+            try {
+                sheet.SetCell("A1"_pos, "=C1");
+                ASSERT(false);
+            } catch (const CircularDependencyException&) {
+            }
+            sheet.SetCells({{"A2"_pos, "x"}, {"A3"_pos, "=1+"}, {"A1"_pos, "5"}});
+            sheet.ClearCell("A2"_pos);
+            sheet.SetCell("A2"_pos, "=A1/0");
+            sheet.ClearCell("B1"_pos);
+            expected = print(sheet);
+        }
+
+        Sheet replayed;
+        ASSERT_EQUAL(ReplayJournal(replayed, journal_path), size_t(8));
+        ASSERT_EQUAL(print(replayed), expected);
+
+        // a record torn by a crash is ignored and cut before the next ones
+        {
+            std::ofstream file(journal_path, std::ios::binary | std::ios::app);
+            file << "S\x01\x02";
+        }
+        {
+            EditJournal journal(journal_path);
+            sheet.SetJournal(&journal);
+            sheet.SetCell("D4"_pos, "=A1*10");
+
+            // checkpoint starts the journal over
+            journal.Checkpoint(sheet, snapshot_path);
+            sheet.SetCell("A1"_pos, "7");
+            sheet.ClearCell("A2"_pos);
+            journal.Commit();
+            sheet.SetJournal(nullptr);
+            sheet.SetCell("A1"_pos, "not logged");
+        }
+        Sheet recovered;
+        LoadSnapshotFromFile(recovered, snapshot_path);
+        ASSERT_EQUAL(ReplayJournal(recovered, journal_path), size_t(2));
+        sheet.SetCell("A1"_pos, "7");
+        ASSERT_EQUAL(print(recovered), print(sheet));
+        ASSERT_EQUAL(recovered.GetCell("D4"_pos)->GetValue(), CellInterface::Value(70.0));
+
+        // pending edits of an idle journal are committed when they are due
+        std::filesystem::remove(journal_path);
+        {
+            EditJournal journal(journal_path, JournalOptions{1024, std::chrono::milliseconds(20)});
+            journal.LogSet("C3"_pos, "4");
+            auto give_up_time = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+            while (journal.GetPendingCount() > 0 && std::chrono::steady_clock::now() < give_up_time) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(5));
+            }
+            ASSERT_EQUAL(journal.GetPendingCount(), size_t(0));
+            Sheet committed;
+            ASSERT_EQUAL(ReplayJournal(committed, journal_path), size_t(1));
+            ASSERT_EQUAL(committed.GetCell("C3"_pos)->GetText(), "4");
+        }
+
+        // a header torn by a crash while the journal was started over is an empty journal
+        for (size_t size : {0, 5}) {
+            {
+                std::ofstream file(journal_path, std::ios::binary | std::ios::trunc);
+                file << std::string("SHEETJNL").substr(0, size);
+            }
+            Sheet empty;
+            ASSERT_EQUAL(ReplayJournal(empty, journal_path), size_t(0));
+            {
+                EditJournal journal(journal_path);
+                journal.LogSet("B2"_pos, "3");
+            }
+            ASSERT_EQUAL(ReplayJournal(empty, journal_path), size_t(1));
+            ASSERT_EQUAL(empty.GetCell("B2"_pos)->GetText(), "3");
+        }
+
+        std::filesystem::remove(journal_path);
+        std::filesystem::remove(snapshot_path);
+    }
+
+    void TestSheetView() {
+        auto print_values = [](const auto& sheet) {
+            std::ostringstream output;
+            sheet.PrintValues(output);
+            return output.str();
+        };
+
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetCell("B1"_pos, "=A1+1");
+        auto view = sheet.CreateView();
+
+        // later edits are not seen by the view
+        sheet.SetCell("A1"_pos, "5");
+        sheet.ClearCell("B1"_pos);
+        sheet.SetCell("C3"_pos, "x");
+        ASSERT_EQUAL(view.GetCell("A1"_pos)->GetText(), "1");
+        ASSERT_EQUAL(view.GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+        ASSERT(view.GetCell("C3"_pos) == nullptr);
+        ASSERT_EQUAL(view.GetPrintableSize(), (Size{1, 2}));
+        ASSERT_EQUAL(print_values(view), "1\t2\n");
+        ASSERT_EQUAL(print_values(sheet), "5\t\t\n\t\t\n\t\tx\n");
+
+        // dirty formulas are calculated for the view
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        sheet.SetCell("B1"_pos, "=A1*2");
+        auto lazy_view = sheet.CreateView();
+        sheet.SetCell("A1"_pos, "7");
+        ASSERT_EQUAL(lazy_view.GetCell("B1"_pos)->GetValue(), CellInterface::Value(10.0));
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(14.0));
+        ASSERT_EQUAL(view.GetCell("A1"_pos)->GetText(), "1");
+
+        // referenced positions without a cell are empty cells, as in the sheet
+        sheet.SetCell("D1"_pos, "=SUM(E1:E3)+F5");
+        auto referencing_view = sheet.CreateView();
+        sheet.ClearCell("D1"_pos);
+        for (auto pos : {"E2"_pos, "F5"_pos}) {
+            ASSERT(referencing_view.GetCell(pos) != nullptr);
+            ASSERT_EQUAL(referencing_view.GetCell(pos)->GetText(), "");
+            ASSERT(sheet.GetCell(pos) == nullptr);
+        }
+        ASSERT(referencing_view.GetCell("E4"_pos) == nullptr);
+        ASSERT(view.GetCell("E2"_pos) == nullptr);
+
+        // readers check views published by the writer while it keeps editing
+        constexpr int ROWS = 40;
+        Sheet edited;
+        for (int row = 0; row < ROWS; ++row) {
+            edited.SetCell(Position{row, 0}, "0");
+            edited.SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "*2");
+        }
+        std::mutex mutex;
+        auto published = std::make_shared<const SheetView>(edited.CreateView());
+        std::atomic<bool> done = false;
+        std::atomic<int> inconsistent = 0;
+
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 3; ++i) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    std::shared_ptr<const SheetView> current;
+                    {
+                        std::lock_guard lock(mutex);
+                        current = published;
+                    }
+                    for (int row = 0; row < ROWS; ++row) {
+                        double number = std::stod(current->GetCell(Position{row, 0})->GetText());
+                        if (!(current->GetCell(Position{row, 1})->GetValue() == CellInterface::Value(number * 2))) {
+                            ++inconsistent;
+                        }
+                    }
+                    std::ostringstream output;
+                    current->PrintValues(output);
+                }
+            });
+        }
+        for (int i = 1; i <= 2000; ++i) {
+            edited.SetCell(Position{i % ROWS, 0}, std::to_string(i));
+            if (i % 10 == 0) {
+                auto view = std::make_shared<const SheetView>(edited.CreateView());
+                std::lock_guard lock(mutex);
+                published = std::move(view);
+            }
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        ASSERT_EQUAL(inconsistent.load(), 0);
+    }
+
+    void TestConcurrentReads() {
+        Sheet sheet;
+        ASSERT(sheet.GetPublishedView() == nullptr);
+        sheet.SetCell("A1"_pos, "1");
+        sheet.SetConcurrentReads(true);
+        ASSERT_EQUAL(sheet.GetPublishedView()->GetCell("A1"_pos)->GetText(), "1");
+
+        // every change is published, dirty formulas are calculated for it
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Lazy);
+        sheet.SetCell("B1"_pos, "=A1+1");
+        ASSERT_EQUAL(sheet.GetPublishedView()->GetCell("B1"_pos)->GetValue(), CellInterface::Value(2.0));
+        sheet.SetCells({{"A1"_pos, "5"}});
+        ASSERT_EQUAL(sheet.GetPublishedView()->GetCell("B1"_pos)->GetValue(), CellInterface::Value(6.0));
+        sheet.ClearCell("B1"_pos);
+        ASSERT(sheet.GetPublishedView()->GetCell("B1"_pos) == nullptr);
+        ASSERT_EQUAL(sheet.GetPublishedView()->GetPrintableSize(), (Size{1, 1}));
+        sheet.SetEvaluationMode(Sheet::EvaluationMode::Eager);
+
+        // readers always see a sum matching its terms, whatever the writer is doing
+        constexpr int ROWS = 32;
+        for (int row = 0; row < ROWS; ++row) {
+            sheet.SetCell(Position{row, 0}, "0");
+        }
+        sheet.SetCell("B1"_pos, "=SUM(A1:A" + std::to_string(ROWS) + ")");
+        std::atomic<bool> done = false;
+        std::atomic<int> inconsistent = 0;
+        std::vector<std::thread> readers;
+        for (int i = 0; i < 3; ++i) {
+            readers.emplace_back([&] {
+                while (!done) {
+                    auto view = sheet.GetPublishedView();
+                    double sum = 0;
+                    for (int row = 0; row < ROWS; ++row) {
+                        // cleared terms are empty cells referenced by the sum
+                        auto cell = view->GetCell(Position{row, 0});
+                        if (cell != nullptr && !cell->GetText().empty()) {
+                            sum += std::stod(cell->GetText());
+                        }
+                    }
+                    if (!(view->GetCell("B1"_pos)->GetValue() == CellInterface::Value(sum))) {
+                        ++inconsistent;
+                    }
+                }
+            });
+        }
+        for (int i = 1; i <= 1000; ++i) {
+            Position pos{i % ROWS, 0};
+            if (i % 7 == 0) {
+                sheet.ClearCell(pos);
+            } else if (i % 5 == 0) {
+                sheet.SetCells({{pos, std::to_string(i)}, {Position{(i + 1) % ROWS, 0}, "1"}});
+            } else {
+                sheet.SetCell(pos, std::to_string(i));
+            }
+        }
+        done = true;
+        for (auto& reader : readers) {
+            reader.join();
+        }
+        ASSERT_EQUAL(inconsistent.load(), 0);
+
+        sheet.SetConcurrentReads(false);
+        ASSERT(sheet.GetPublishedView() == nullptr);
+    }
+
+    void TestClearRange() {
+        for (auto mode : {Sheet::EvaluationMode::Eager, Sheet::EvaluationMode::Lazy}) {
+            Sheet sheet;
+            sheet.SetEvaluationMode(mode);
+            for (int row = 0; row < 50; ++row) {
+                sheet.SetCell(Position{row, 0}, std::to_string(row + 1));
+                sheet.SetCell(Position{row, 1}, "=A" + std::to_string(row + 1) + "*2");
+            }
+            sheet.SetCell("C1"_pos, "=SUM(A1:B50)");
+            sheet.SetCell("D60"_pos, "=A50");
+            ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{60, 4}));
+
+            // bounds shrink to the cells left
+            sheet.ClearRange(CellRange{"A11"_pos, "B50"_pos});
+            ASSERT_EQUAL(sheet.GetCell("A11"_pos)->GetText(), "");
+            ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{60, 4}));
+            ASSERT_EQUAL(sheet.GetCell("C1"_pos)->GetValue(), CellInterface::Value(165.0));
+            ASSERT_EQUAL(sheet.GetCell("D60"_pos)->GetValue(), CellInterface::Value(0.0));
+
+            sheet.ClearRange(CellRange{"D1"_pos, "D100"_pos});
+            ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{10, 3}));
+            sheet.ClearCell("C1"_pos);
+            ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{10, 2}));
+            sheet.ClearRange(CellRange{"A1"_pos, "Z100"_pos});
+            ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{0, 0}));
+        }
+
+        Sheet sheet;
+        try {
+            sheet.ClearRange(CellRange{"B2"_pos, "A1"_pos});
+            ASSERT(false);
+        } catch (const InvalidPositionException&) {
+        }
+
+        // clearing a long column cell by cell stays linear
+        constexpr int ROWS = 16384;
+        std::vector<std::pair<Position, std::string>> edits;
+        for (int row = 0; row < ROWS; ++row) {
+            edits.emplace_back(Position{row, 0}, "x");
+            edits.emplace_back(Position{row, 1}, "y");
+        }
+        sheet.SetCells(std::move(edits));
+        for (int row = ROWS - 1; row >= 0; --row) {
+            sheet.ClearCell(Position{row, 1});
+            ASSERT_EQUAL(sheet.GetPrintableSize(), (Size{ROWS, row > 0 ? 2 : 1}));
+        }
+    }
+
+    void TestTextNumbers() {
+        Sheet sheet;
+        sheet.SetCell("A1"_pos, "12.5");
+        sheet.SetCell("A2"_pos, "'3");
+        sheet.SetCell("A3"_pos, "abc");
+        sheet.SetCell("B1"_pos, "=A1+A2");
+        sheet.SetCell("B2"_pos, "=A3");
+        sheet.SetCell("B3"_pos, "=SUM(A1:A3)");
+        ASSERT_EQUAL(sheet.GetCell("B1"_pos)->GetValue(), CellInterface::Value(15.5));
+        ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(),
+                     CellInterface::Value(FormulaError(FormulaError::Category::Value)));
+        ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(15.5));
+
+        // numbers are taken again with new texts, texts themselves stay as they are
+        sheet.SetCell("A3"_pos, "1.5");
+        sheet.SetCell("A1"_pos, "x");
+        ASSERT_EQUAL(sheet.GetCell("B2"_pos)->GetValue(), CellInterface::Value(1.5));
+        ASSERT_EQUAL(sheet.GetCell("B3"_pos)->GetValue(), CellInterface::Value(4.5));
+        ASSERT_EQUAL(sheet.GetCell("A3"_pos)->GetValue(), CellInterface::Value("1.5"));
+        ASSERT_EQUAL(sheet.GetCell("A2"_pos)->GetText(), "'3");
+    }
+
+    void TestDependencyIndexRemoval() {
+        DependencyIndex index;
+        std::vector<std::pair<CellRange, Position>> references;
+        for (int i = 0; i < 3000; ++i) {
+            Position dependent{i / 8, 10 + i % 8};
+            // a hot cell, ranges over several buckets and a formula with a repeated range
+            references.emplace_back(CellRange{"A1"_pos, "A1"_pos}, dependent);
+            references.emplace_back(CellRange{Position{i % 50, 0}, Position{i % 50 + 3, 4}}, dependent);
+            if (i % 10 == 0) {
+                references.emplace_back(CellRange{"A1"_pos, "A1"_pos}, dependent);
+            }
+        }
+        for (const auto& [range, dependent] : references) {
+            index.Add(range, dependent);
+        }
+
+        auto collect = [&index](Position pos) {
+            std::vector<Position> dependents;
+            index.ForEachDependent(pos, [&dependents](Position dependent) {
+                dependents.push_back(dependent);
+            });
+            std::sort(dependents.begin(), dependents.end());
+            return dependents;
+        };
+        auto expect = [&references](Position pos) {
+            std::vector<Position> dependents;
+            for (const auto& [range, dependent] : references) {
+                if (range.Contains(pos)) {
+                    dependents.push_back(dependent);
+                }
+            }
+            std::sort(dependents.begin(), dependents.end());
+            return dependents;
+        };
+
+        // removals in random order move entries around buckets and compact the ids
+        std::mt19937 generator(17);
+        std::shuffle(references.begin(), references.end(), generator);
+        while (!references.empty()) {
+            size_t count = std::min<size_t>(references.size(), 700);
+            for (size_t i = 0; i < count; ++i) {
+                index.Remove(references.back().first, references.back().second);
+                references.pop_back();
+            }
+            for (auto pos : {"A1"_pos, "C3"_pos, "E52"_pos, "B20"_pos}) {
+                ASSERT_EQUAL(collect(pos), expect(pos));
+            }
+        }
+        ASSERT(!index.HasDependents("A1"_pos));
+
+        // removing what's not there changes nothing
+        index.Add(CellRange{"B2"_pos, "C3"_pos}, "D4"_pos);
+        index.Remove(CellRange{"B2"_pos, "C4"_pos}, "D4"_pos);
+        index.Remove(CellRange{"B2"_pos, "C3"_pos}, "D5"_pos);
+        ASSERT_EQUAL(collect("C3"_pos), std::vector<Position>{"D4"_pos});
+    }
+
+    void TestPositionKeys() {
+        static_assert(Position::FromString("XFD16384") == Position{16383, 16383});
+        static_assert(!Position::FromString("A01B").IsValid());
+        static_assert(Position{2, 3}.ToKey() < Position{3, 0}.ToKey());
+        static_assert(Position::FromMortonKey(Position{5, 9}.ToMortonKey()) == Position{5, 9});
+
+        char buffer[Position::MAX_STRING_LENGTH];
+        ASSERT_EQUAL(std::string(buffer, "AB12"_pos.ToChars(buffer)), "AB12");
+        ASSERT_EQUAL(Position::NONE.ToChars(buffer), 0u);
+        ASSERT_EQUAL(Position::FromString("A007"), "A7"_pos);
+
+        std::mt19937 random(7);
+        std::vector<Position> positions;
+        for (int i = 0; i < 1000; ++i) {
+            positions.push_back({static_cast<int>(random() % Position::MAX_ROWS),
+                                 static_cast<int>(random() % Position::MAX_COLS)});
+        }
+        positions.push_back({0, 0});
+        positions.push_back({Position::MAX_ROWS - 1, Position::MAX_COLS - 1});
+        for (auto pos : positions) {
+            ASSERT_EQUAL(Position::FromKey(pos.ToKey()), pos);
+            ASSERT_EQUAL(Position::FromMortonKey(pos.ToMortonKey()), pos);
+            ASSERT_EQUAL(Position::FromString(pos.ToString()), pos);
+        }
+
+        auto by_key = positions;
+        std::sort(by_key.begin(), by_key.end(), [](Position lhs, Position rhs) {
+            return lhs.ToKey() < rhs.ToKey();
+        });
+        ASSERT(std::is_sorted(by_key.begin(), by_key.end()));
+
+        // Morton keys of a 16x16 tile are 256 keys in a row
+        std::vector<uint32_t> keys;
+        for (int row = 32; row < 48; ++row) {
+            for (int col = 16; col < 32; ++col) {
+                keys.push_back(Position{row, col}.ToMortonKey());
+            }
+        }
+        std::sort(keys.begin(), keys.end());
+        ASSERT_EQUAL(keys.back() - keys.front(), 255u);
+    }
 }  // namespace
 
 int main() {
@@ -370,5 +1589,31 @@ int main() {
     RUN_TEST(tr, TestCellReferences);
     RUN_TEST(tr, TestFormulaIncorrect);
     RUN_TEST(tr, TestCellCircularReferences);
+    RUN_TEST(tr, TestDiamondRecalculation);
+    RUN_TEST(tr, TestClearReferencedCell);
+    RUN_TEST(tr, TestLazyEvaluation);
+    RUN_TEST(tr, TestLazyEvaluationLongChain);
+    RUN_TEST(tr, TestCircularReferencesInDeepChain);
+    RUN_TEST(tr, TestFormulaCache);
+    RUN_TEST(tr, TestDescentParserMatchesAntlr);
+    RUN_TEST(tr, TestFormulaDeepNesting);
+    RUN_TEST(tr, TestSparseStorage);
+    RUN_TEST(tr, TestCellRecordsReuse);
+    RUN_TEST(tr, TestFormulaRanges);
+    RUN_TEST(tr, TestFormulaRangesLazy);
+    RUN_TEST(tr, TestRangeDependencies);
+    RUN_TEST(tr, TestParallelRecalculation);
+    RUN_TEST(tr, TestParallelIrregularGraphs);
+    RUN_TEST(tr, TestSetCells);
+    RUN_TEST(tr, TestImportTexts);
+    RUN_TEST(tr, TestPrintRange);
+    RUN_TEST(tr, TestSnapshot);
+    RUN_TEST(tr, TestEditJournal);
+    RUN_TEST(tr, TestSheetView);
+    RUN_TEST(tr, TestConcurrentReads);
+    RUN_TEST(tr, TestClearRange);
+    RUN_TEST(tr, TestTextNumbers);
+    RUN_TEST(tr, TestDependencyIndexRemoval);
+    RUN_TEST(tr, TestPositionKeys);
     return 0;
 }
\ No newline at end of file
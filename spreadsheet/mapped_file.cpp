@@ -0,0 +1,58 @@
+#include "mapped_file.h"
+
+#include <stdexcept>
+
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string& path) {
+    std::ifstream input(path, std::ios::binary);
+    if (!input) {
+        throw std::runtime_error("Can't open " + path);
+    }
+    content_.assign(std::istreambuf_iterator<char>(input), std::istreambuf_iterator<char>());
+    data_ = content_;
+}
+
+MappedFile::~MappedFile() {
+}
+#else
+MappedFile::MappedFile(const std::string& path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Can't open " + path);
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        close(fd);
+        throw std::runtime_error("Can't read " + path);
+    }
+
+    // empty files can't be mapped
+    if (info.st_size > 0) {
+        void* address = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED) {
+            close(fd);
+            throw std::runtime_error("Can't map " + path);
+        }
+        madvise(address, info.st_size, MADV_SEQUENTIAL);
+        data_ = std::string_view(static_cast<const char*>(address), info.st_size);
+    }
+    // the mapping stays valid without the descriptor
+    close(fd);
+}
+
+MappedFile::~MappedFile() {
+    if (!data_.empty()) {
+        munmap(const_cast<char*>(data_.data()), data_.size());
+    }
+}
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <string>
+#include <string_view>
+
+// Whole file available as a read-only string_view, mapped to memory where
+// possible. Throws std::runtime_error if the file can't be read
+class MappedFile {
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    std::string_view GetData() const {
+        return data_;
+    }
+
+private:
+    std::string_view data_;
+#ifdef _WIN32
+    // no mapping, the file is read to memory
+    std::string content_;
+#endif
+};
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <memory>
+#include <thread>
+
+// Object published by a single writer for any number of reader threads. Readers
+// take the latest object without locks: the object is held in one of two slots
+// counting readers copying it, the writer fills the other slot when nobody is
+// in it and then makes it current.
+template <typename T>
+class PublishedPtr {
+public:
+    PublishedPtr() = default;
+    PublishedPtr(const PublishedPtr&) = delete;
+    PublishedPtr& operator=(const PublishedPtr&) = delete;
+
+    // The object published last, nullptr if there's none. May be called by any thread
+    std::shared_ptr<const T> Load() const {
+        for (;;) {
+            int index = current_.load();
+            auto& slot = slots_[index];
+            slot.readers.fetch_add(1);
+            // the slot may have been taken for the next object before it was entered
+            if (current_.load() == index) {
+                auto object = slot.object;
+                slot.readers.fetch_sub(1);
+                return object;
+            }
+            slot.readers.fetch_sub(1);
+        }
+    }
+
+    // Replaces the published object, called by the writer thread only
+    void Publish(std::shared_ptr<const T> object) {
+        int next = 1 - current_.load();
+        auto& slot = slots_[next];
+        // readers stay in a slot only while copying the pointer
+        while (slot.readers.load() != 0) {
+            std::this_thread::yield();
+        }
+        slot.object = std::move(object);
+        current_.store(next);
+    }
+
+private:
+    // slots are apart, so readers of one don't slow down the writer filling another
+    struct alignas(64) Slot {
+        std::atomic<int> readers = 0;
+        std::shared_ptr<const T> object;
+    };
+
+    mutable std::array<Slot, 2> slots_;
+    std::atomic<int> current_ = 0;
+};
@@ -7,11 +7,107 @@
 #include <functional>
 #include <iostream>
 #include <optional>
+#include <unordered_map>
+#include <utility>
 
 #include <iostream>
 
 using namespace std::literals;
 
+namespace {
+    bool IsFormulaText(std::string_view text) {
+        return !text.empty() && text[0] == '=' && text != "=";
+    }
+
+    // buffers are written out when they grow over FLUSH_SIZE
+    constexpr size_t FLUSH_SIZE = 1 << 20;
+
+    // Appends rows of range between first_row and last_row to buffer, values of
+    // formulas are expected to be calculated
+    void FormatRows(const CellStorage& storage, std::string& buffer, CellRange range,
+                    int first_row, int last_row, bool print_values) {
+        for (int row = first_row; row <= last_row; ++row) {
+            // fields are separated by tabs, empty runs are skipped tile by tile
+            int col = range.first.col;
+            CellRange row_range{{row, range.first.col}, {row, range.last.col}};
+            storage.ForEachInRange(row_range, [&](Position pos, const Cell& cell) {
+                buffer.append(pos.col - col, '\t');
+                col = pos.col;
+                if (print_values) {
+                    cell.AppendValue(buffer);
+                } else {
+                    cell.AppendText(buffer);
+                }
+            });
+            buffer.append(range.last.col - col, '\t');
+            buffer += '\n';
+        }
+    }
+
+    // Same for all rows of range written to output by the calling thread
+    void WriteRows(const CellStorage& storage, std::ostream& output, CellRange range, bool print_values) {
+        std::string buffer;
+        for (int row = range.first.row; row <= range.last.row; ++row) {
+            FormatRows(storage, buffer, range, row, row, print_values);
+            if (buffer.size() >= FLUSH_SIZE) {
+                output.write(buffer.data(), buffer.size());
+                buffer.clear();
+            }
+        }
+        output.write(buffer.data(), buffer.size());
+    }
+}  // namespace
+
+SheetView::SheetView(CellStorage storage, Size printable_size)
+    : storage_(std::move(storage))
+    , printable_size_(printable_size)
+{
+}
+
+const CellInterface* SheetView::GetCell(Position pos) const {
+    if (!pos.IsValid()) {
+        throw InvalidPositionException("GetCell ERROR: InvalidPosition.");
+    }
+    if (auto cell = storage_.Get(pos)) {
+        return cell;
+    }
+    return GetDependencies().HasDependents(pos) ? &empty_cell_ : nullptr;
+}
+
+const DependencyIndex& SheetView::GetDependencies() const {
+    // the view holds it as long as it's alive, so a reference is enough
+    if (auto dependencies = std::atomic_load(&dependencies_)) {
+        return *dependencies;
+    }
+    auto dependencies = std::make_shared<DependencyIndex>();
+    storage_.ForEach([&dependencies](Position pos, const Cell& cell) {
+        for (const auto& range : cell.GetReferencedRanges()) {
+            dependencies->Add(range, pos);
+        }
+    });
+    std::shared_ptr<const DependencyIndex> expected;
+    if (!std::atomic_compare_exchange_strong(&dependencies_, &expected, std::shared_ptr<const DependencyIndex>(dependencies))) {
+        // another reader was first
+        return *expected;
+    }
+    return *dependencies;
+}
+
+Size SheetView::GetPrintableSize() const {
+    return printable_size_;
+}
+
+void SheetView::PrintValues(std::ostream& output) const {
+    if (printable_size_.rows > 0) {
+        WriteRows(storage_, output, CellRange{{0, 0}, {printable_size_.rows - 1, printable_size_.cols - 1}}, true);
+    }
+}
+
+void SheetView::PrintTexts(std::ostream& output) const {
+    if (printable_size_.rows > 0) {
+        WriteRows(storage_, output, CellRange{{0, 0}, {printable_size_.rows - 1, printable_size_.cols - 1}}, false);
+    }
+}
 
 Sheet::~Sheet() {
 }
@@ -22,98 +118,381 @@ void Sheet::SetCell(Position pos, std::string text) {
         throw InvalidPositionException("SetCell ERROR: InvalidPosition.");
     }
 
-    // Check circular dependencies
-    if (!text.empty() && text[0] == '=' && text != "=") {
-        auto referenced = ParseFormula(text.substr(1))->GetReferencedCells();
-        bool is_cycle = FindCyclicDependencies(referenced, pos);
+    // Check circular dependencies, the parsed formula is handed to the cell then
+    std::shared_ptr<const FormulaInterface> formula;
+    if (IsFormulaText(text)) {
+        formula = formula_cache_.Parse(std::string_view(text).substr(1));
+        bool is_cycle = HasCircularDependency(pos, formula->GetReferencedRanges());
 
         if (is_cycle) {
             throw CircularDependencyException("Sheet SetCell ERROR: Formula Circular Dependency");
         }
     }
 
+    if (journal_ != nullptr) {
+        journal_->LogSet(pos, text);
+    }
 
-    auto cell_ptr = dynamic_cast<Cell*>(GetCell(pos));
+
+    auto cell_ptr = FindCell(pos);
 
     // Delete old dependencies if this cell not new
     if (cell_ptr != nullptr) {
-        for (const auto& ref_cell_pos : cell_ptr->GetReferencedCells()) {
-            auto referenced = dynamic_cast<Cell*>(GetCell(ref_cell_pos));
-            if (referenced != nullptr) {
-                referenced->DeleteDependency(pos);
-            }
+        for (const auto& range : cell_ptr->GetReferencedRanges()) {
+            dependencies_.Remove(range, pos);
         }
     }
 
-    // Create new cell in pos or set old
+    // Create new cell in pos or set old. New cell referenced by formulas goes to the
+    // beginning of topological order, otherwise it has no dependents yet and can be
+    // placed at the end
     if (cell_ptr == nullptr) {
+        cell_ptr = CreateCell(pos, dependencies_.HasDependents(pos) ? --min_order_ : ++max_order_);
+    }
+    cell_ptr->Set(std::move(text), std::move(formula));
+
+    // Adding New Dependencies after changing formula and refreshing dependent values.
+    // Referenced positions without cells need no order, they get it when created
+    for (const auto& range : cell_ptr->GetReferencedRanges()) {
+        dependencies_.Add(range, pos);
+        // reordering may copy tiles shared with views, so it's not done while they are walked
+        std::vector<Position> referenced_positions;
+        storage_.ForEachInRange(range, [&referenced_positions](Position referenced_pos, const Cell&) {
+            referenced_positions.push_back(referenced_pos);
+        });
+        for (auto referenced_pos : referenced_positions) {
+            if (std::as_const(*this).FindCell(referenced_pos)->GetOrder() > cell_ptr->GetOrder()) {
+                RestoreTopologicalOrder(referenced_pos, pos);
+            }
+        }
+    }
+
+    OnCellChanged(pos);
+    PublishView();
 
-        // resize table for new cell
-        if (ptr_table_.size() <= size_t(pos.row)) {
-            ptr_table_.resize(pos.row + 1);
+}
+
+template <typename Text>
+std::vector<Sheet::CellError> Sheet::ApplyEdits(std::vector<std::pair<Position, Text>>& edits) {
+    std::vector<CellError> errors;
+
+    // formulas missing in the cache are parsed once per distinct expression
+    std::vector<std::shared_ptr<const FormulaInterface>> formulas(edits.size());
+    std::vector<std::string_view> expressions;
+    std::unordered_map<std::string_view, size_t> expression_indexes;
+    std::vector<size_t> edit_expressions(edits.size());
+    for (size_t index = 0; index < edits.size(); ++index) {
+        const auto& [pos, text] = edits[index];
+        if (!pos.IsValid() || !IsFormulaText(text)) {
+            continue;
         }
+        auto expression = std::string_view(text).substr(1);
+        formulas[index] = formula_cache_.Find(expression);
+        if (formulas[index] == nullptr) {
+            auto [it, is_new] = expression_indexes.emplace(expression, expressions.size());
+            if (is_new) {
+                expressions.push_back(expression);
+            }
+            edit_expressions[index] = it->second;
+        }
+    }
+    auto parsed = ParseFormulas(expressions);
+    for (size_t i = 0; i < expressions.size(); ++i) {
+        if (parsed[i] != nullptr) {
+            formula_cache_.Insert(expressions[i], parsed[i]);
+        }
+    }
 
-        if (ptr_table_.at(pos.row).size() <= size_t(pos.col)) {
-            ptr_table_[pos.row].resize(pos.col + 1);
+    std::vector<PendingEdit> batch;
+    std::unordered_map<Position, size_t, PositionHasher> batch_indexes;
+    // earlier edits of positions edited again, each of them takes the place of the
+    // next one if that one closes a cycle, as it would with SetCell() called in order
+    std::unordered_map<Position, std::vector<PendingEdit>, PositionHasher> replaced_edits;
+    for (size_t index = 0; index < edits.size(); ++index) {
+        const auto& [pos, text] = edits[index];
+        if (!pos.IsValid()) {
+            errors.push_back({index, pos, CellError::Reason::InvalidPosition});
+            continue;
         }
 
-        // update minimal print area
-        if (pos.col + 1 > max_width_) {
-            max_width_  = pos.col + 1;
+        std::shared_ptr<const FormulaInterface> formula;
+        if (IsFormulaText(text)) {
+            formula = formulas[index] != nullptr ? std::move(formulas[index]) : parsed[edit_expressions[index]];
+            if (formula == nullptr) {
+                errors.push_back({index, pos, CellError::Reason::InvalidFormula});
+                continue;
+            }
         }
-        if (pos.row + 1 > max_height_) {
-            max_height_ = pos.row + 1;
+
+        PendingEdit edit{index, pos, std::move(formula)};
+        auto [it, is_new] = batch_indexes.emplace(pos, batch.size());
+        if (is_new) {
+            batch.push_back(std::move(edit));
+        } else {
+            replaced_edits[pos].push_back(std::move(batch[it->second]));
+            batch[it->second] = std::move(edit);
         }
+    }
 
-        ptr_table_[pos.row][pos.col] = std::make_unique<Cell>(*this);
-        cell_ptr = dynamic_cast<Cell*>(GetCell(pos));
-        cell_ptr->Set(text);
-    } else {
-        cell_ptr->Set(text);
+    // formulas closing cycles are dropped until the rest of the batch can be ordered
+    std::vector<Position> sorted;
+    for (;;) {
+        std::vector<size_t> cyclic;
+        if (auto result = SortEditedCells(batch, cyclic)) {
+            sorted = std::move(*result);
+            break;
+        }
+
+        std::vector<bool> is_cyclic(batch.size());
+        for (size_t i : cyclic) {
+            is_cyclic[i] = true;
+            errors.push_back({batch[i].index, batch[i].pos, CellError::Reason::CircularDependency});
+        }
+        std::vector<PendingEdit> kept;
+        kept.reserve(batch.size() - cyclic.size());
+        for (size_t i = 0; i < batch.size(); ++i) {
+            if (!is_cyclic[i]) {
+                kept.push_back(std::move(batch[i]));
+                continue;
+            }
+            auto replaced = replaced_edits.find(batch[i].pos);
+            if (replaced != replaced_edits.end() && !replaced->second.empty()) {
+                kept.push_back(std::move(replaced->second.back()));
+                replaced->second.pop_back();
+            }
+        }
+        batch = std::move(kept);
+    }
+    std::sort(errors.begin(), errors.end(), [](const CellError& lhs, const CellError& rhs) {
+        return lhs.index < rhs.index;
+    });
+
+    if (journal_ != nullptr) {
+        std::vector<std::pair<Position, std::string_view>> logged;
+        logged.reserve(batch.size());
+        for (const auto& edit : batch) {
+            logged.emplace_back(edit.pos, edits[edit.index].second);
+        }
+        journal_->LogSets(logged);
     }
 
-    // Adding New Dependencies after changing formula and refreshing dependent values
-    for (const auto& new_cell_ref_pos : cell_ptr->GetReferencedCells()) {
-        auto referenced = dynamic_cast<Cell*>(GetCell(new_cell_ref_pos));
-        // if referenced to non-existing pos, creates Empty Cell to add dependency
-        if (referenced == nullptr) {
-            SetCell(new_cell_ref_pos, "");
+    for (auto& edit : batch) {
+        auto cell = FindCell(edit.pos);
+        if (cell != nullptr) {
+            for (const auto& range : cell->GetReferencedRanges()) {
+                dependencies_.Remove(range, edit.pos);
+            }
+        } else {
+            cell = CreateCell(edit.pos, 0);
         }
-        // this needed to refresh ptr if empty cell was created
-        referenced = dynamic_cast<Cell*>(GetCell(new_cell_ref_pos));
+        cell->Set(std::string(std::move(edits[edit.index].second)), std::move(edit.formula));
+        for (const auto& range : cell->GetReferencedRanges()) {
+            dependencies_.Add(range, edit.pos);
+        }
+    }
 
-        referenced->AddDependency(pos);
+    // nothing outside of the affected cells depends on them, so they are placed
+    // after all other cells
+    std::vector<std::pair<Position, Cell*>> cells;
+    cells.reserve(sorted.size());
+    for (auto pos : sorted) {
+        auto cell = FindCell(pos);
+        cell->SetOrder(++max_order_);
+        cells.emplace_back(pos, cell);
     }
 
-    // Recursive recalculation without itself recalculation
-    cell_ptr->RecursiveRecalculateValueCycle();
+    if (evaluation_mode_ == EvaluationMode::Lazy) {
+        for (auto [pos, cell] : cells) {
+            cell->InvalidateCache();
+            AddDirtyPosition(pos);
+        }
+    } else {
+        RecalculateCells(cells);
+    }
+    PublishView();
+    return errors;
+}
 
+std::vector<Sheet::CellError> Sheet::SetCells(std::vector<std::pair<Position, std::string>> edits) {
+    return ApplyEdits(edits);
 }
 
-const CellInterface* Sheet::GetCell(Position pos) const {
+std::vector<Sheet::CellError> Sheet::SetCellsFromViews(std::vector<std::pair<Position, std::string_view>> edits) {
+    return ApplyEdits(edits);
+}
 
-    if (!pos.IsValid()) {
-        throw InvalidPositionException("GetCell ERROR: InvalidPosition.");
+std::vector<std::shared_ptr<const FormulaInterface>> Sheet::ParseFormulas(
+        const std::vector<std::string_view>& expressions) const {
+    // parsing is independent for every expression, small batches stay on this thread
+    constexpr size_t MIN_PARALLEL_FORMULAS = 256;
+    constexpr size_t BLOCK_SIZE = 64;
+
+    std::vector<std::shared_ptr<const FormulaInterface>> formulas(expressions.size());
+    auto parse = [&expressions, &formulas](size_t i) {
+        try {
+            formulas[i] = ParseFormula(std::string(expressions[i]));
+        } catch (const FormulaException&) {
+        }
+    };
+    if (thread_pool_ != nullptr && expressions.size() >= MIN_PARALLEL_FORMULAS) {
+        thread_pool_->ParallelFor(expressions.size(), BLOCK_SIZE, parse);
+    } else {
+        for (size_t i = 0; i < expressions.size(); ++i) {
+            parse(i);
+        }
+    }
+    return formulas;
+}
+
+std::optional<std::vector<Position>> Sheet::SortEditedCells(const std::vector<PendingEdit>& edits,
+                                                            std::vector<size_t>& cyclic) const {
+    // nodes of the affected subgraph, edits go first with the same indexes
+    std::unordered_map<Position, size_t, PositionHasher> nodes;
+    std::vector<Position> positions;
+    for (const auto& edit : edits) {
+        nodes.emplace(edit.pos, positions.size());
+        positions.push_back(edit.pos);
+    }
+
+    // edited formulas replace references of the cells they are put to
+    DependencyIndex edited_dependencies;
+    for (const auto& edit : edits) {
+        if (edit.formula != nullptr) {
+            for (const auto& range : edit.formula->GetReferencedRanges()) {
+                edited_dependencies.Add(range, edit.pos);
+            }
+        }
+    }
+    auto for_each_dependent = [&](Position pos, auto&& func) {
+        dependencies_.ForEachDependent(pos, [&](Position dependent) {
+            auto node = nodes.find(dependent);
+            if (node == nodes.end() || node->second >= edits.size()) {
+                func(dependent);
+            }
+        });
+        edited_dependencies.ForEachDependent(pos, func);
+    };
+
+    std::vector<uint32_t> input_counts(positions.size(), 0);
+    for (size_t i = 0; i < positions.size(); ++i) {
+        for_each_dependent(positions[i], [&](Position dependent) {
+            auto [node, is_new] = nodes.emplace(dependent, positions.size());
+            if (is_new) {
+                positions.push_back(dependent);
+                input_counts.push_back(0);
+            }
+            ++input_counts[node->second];
+        });
     }
 
-    if (ptr_table_.size() > size_t(pos.row) && ptr_table_.at(pos.row).size() > size_t(pos.col)) {
-        return ptr_table_[pos.row][pos.col].get();
+    std::vector<Position> sorted;
+    sorted.reserve(positions.size());
+    for (size_t i = 0; i < positions.size(); ++i) {
+        if (input_counts[i] == 0) {
+            sorted.push_back(positions[i]);
+        }
+    }
+    for (size_t i = 0; i < sorted.size(); ++i) {
+        for_each_dependent(sorted[i], [&](Position dependent) {
+            if (--input_counts[nodes.at(dependent)] == 0) {
+                sorted.push_back(dependent);
+            }
+        });
+    }
+    if (sorted.size() == positions.size()) {
+        return sorted;
     }
 
-    return nullptr;
+    // The old graph has no cycles, so each of the left ones passes an edited formula.
+    // Cells left are on cycles or after them, edits reaching themselves are rejected
+    for (size_t i = 0; i < edits.size(); ++i) {
+        if (input_counts[i] == 0) {
+            continue;
+        }
+        bool is_cycle = false;
+        std::unordered_set<Position, PositionHasher> visited;
+        std::vector<Position> stack{edits[i].pos};
+        while (!stack.empty() && !is_cycle) {
+            auto current = stack.back();
+            stack.pop_back();
+            for_each_dependent(current, [&](Position dependent) {
+                if (dependent == edits[i].pos) {
+                    is_cycle = true;
+                } else if (visited.insert(dependent).second) {
+                    stack.push_back(dependent);
+                }
+            });
+        }
+        if (is_cycle) {
+            cyclic.push_back(i);
+        }
+    }
+    return std::nullopt;
 }
 
-CellInterface* Sheet::GetCell(Position pos) {
+Cell* Sheet::CreateCell(Position pos, int order) {
+    // update minimal print area
+    if (pos.col + 1 > max_width_) {
+        max_width_  = pos.col + 1;
+    }
+    if (pos.row + 1 > max_height_) {
+        max_height_ = pos.row + 1;
+    }
+
+    if (row_counts_.size() <= static_cast<size_t>(pos.row)) {
+        row_counts_.resize(pos.row + 1);
+    }
+    if (col_counts_.size() <= static_cast<size_t>(pos.col)) {
+        col_counts_.resize(pos.col + 1);
+    }
+    ++row_counts_[pos.row];
+    ++col_counts_[pos.col];
+
+    auto cell = storage_.Emplace(pos);
+    cell->SetOrder(order);
+    return cell;
+}
+
+const Cell* Sheet::FindCell(Position pos) const {
+    return storage_.Get(pos);
+}
+
+Cell* Sheet::FindCell(Position pos) {
+    return storage_.GetMutable(pos);
+}
+
+std::optional<FormulaError> Sheet::CollectNumbers(CellRange range, std::vector<double>& numbers) const {
+    std::optional<FormulaError> error;
+    storage_.ForEachInRange(range, [&numbers, &error](Position, const Cell& cell) {
+        if (error) {
+            return;
+        }
+        if (auto value = cell.GetRangeValue()) {
+            if (auto number = std::get_if<double>(&*value)) {
+                numbers.push_back(*number);
+            } else {
+                error = std::get<FormulaError>(*value);
+            }
+        }
+    });
+    return error;
+}
+
+const CellInterface* Sheet::GetCell(Position pos) const {
 
     if (!pos.IsValid()) {
         throw InvalidPositionException("GetCell ERROR: InvalidPosition.");
     }
 
-    if (ptr_table_.size() > size_t(pos.row) && ptr_table_.at(pos.row).size() > size_t(pos.col)) {
-        return ptr_table_[pos.row][pos.col].get();
+    if (auto cell = storage_.Get(pos)) {
+        return cell;
     }
+    // cells referenced by formulas are visible as empty ones
+    return dependencies_.HasDependents(pos) ? &empty_cell_ : nullptr;
+}
 
-    return nullptr;
+CellInterface* Sheet::GetCell(Position pos) {
+    return const_cast<CellInterface*>(std::as_const(*this).GetCell(pos));
 }
 
 void Sheet::ClearCell(Position pos) {
@@ -122,16 +501,71 @@ void Sheet::ClearCell(Position pos) {
         throw InvalidPositionException("ClearCell ERROR: InvalidPosition.");
     }
 
-    if (pos.IsValid() && ptr_table_.size() > size_t(pos.row) && ptr_table_.at(pos.row).size() > size_t(pos.col)) {
-        // Recursive recalculation
-        auto cell_ptr = dynamic_cast<Cell*>(GetCell(pos));
-        if (cell_ptr != nullptr) {
-            cell_ptr->Clear();
+    if (FindCell(pos) != nullptr) {
+        if (journal_ != nullptr) {
+            journal_->LogClear(pos);
         }
-        ptr_table_[pos.row][pos.col].reset();
+        EraseCell(pos);
+        ShrinkPrintableSize();
+        OnCellChanged(pos);
+        PublishView();
+    }
+}
+
+void Sheet::ClearRange(CellRange range) {
+    if (!range.IsValid()) {
+        throw InvalidPositionException("ClearRange ERROR: InvalidRange.");
     }
 
-    FindAndDecreaseMaxHeightAndWidth();
+    std::vector<Position> positions;
+    storage_.ForEachInRange(range, [&positions](Position pos, const Cell&) {
+        positions.push_back(pos);
+    });
+    if (positions.empty()) {
+        return;
+    }
+
+    if (journal_ != nullptr) {
+        journal_->LogClears(positions);
+    }
+    for (auto pos : positions) {
+        EraseCell(pos);
+    }
+    ShrinkPrintableSize();
+
+    // formulas of the range don't depend on cleared cells any more
+    positions.erase(std::remove_if(positions.begin(), positions.end(),
+                                   [this](Position pos) {
+                                       return !dependencies_.HasDependents(pos);
+                                   }),
+                    positions.end());
+    if (evaluation_mode_ == EvaluationMode::Lazy) {
+        for (auto pos : positions) {
+            InvalidateDependents(pos);
+        }
+    } else if (!positions.empty()) {
+        RecalculateCells(CollectDirtyCells(positions));
+    }
+    PublishView();
+}
+
+void Sheet::EraseCell(Position pos) {
+    for (const auto& range : FindCell(pos)->GetReferencedRanges()) {
+        dependencies_.Remove(range, pos);
+    }
+    storage_.Erase(pos);
+    --row_counts_[pos.row];
+    --col_counts_[pos.col];
+}
+
+void Sheet::ShrinkPrintableSize() {
+    // every step drops a row or a column that was filled once, so it's O(1) amortized
+    while (max_height_ > 0 && row_counts_[max_height_ - 1] == 0) {
+        --max_height_;
+    }
+    while (max_width_ > 0 && col_counts_[max_width_ - 1] == 0) {
+        --max_width_;
+    }
 }
 
 Size Sheet::GetPrintableSize() const {
@@ -139,101 +573,358 @@ Size Sheet::GetPrintableSize() const {
 }
 
 void Sheet::PrintValues(std::ostream& output) const {
+    if (max_height_ > 0) {
+        PrintCells(output, CellRange{{0, 0}, {max_height_ - 1, max_width_ - 1}}, true);
+    }
+}
 
-    if (ptr_table_.empty()) {
-        return;
+void Sheet::PrintTexts(std::ostream& output) const {
+    if (max_height_ > 0) {
+        PrintCells(output, CellRange{{0, 0}, {max_height_ - 1, max_width_ - 1}}, false);
     }
+}
 
-    for (auto row = 0; row < max_height_; ++row) {
-        bool is_first = true;
-        for (auto col = 0; col < max_width_; ++col) {
-            if (!is_first) {
-                output << '\t';
-            }
-            if (ptr_table_[row].size() > size_t(col) && ptr_table_[row][col] != nullptr) {
-                auto val = ptr_table_[row][col]->GetValue();
-                if (std::holds_alternative<double>(val)) {
-                    output << std::get<double>(val);
-                } else if (std::holds_alternative<std::string>(val)) {
-                    output << std::get<std::string>(val);
-                } else if (std::holds_alternative<FormulaError>(val)) {
-                    output << std::get<FormulaError>(val);
-                }
+void Sheet::PrintValues(std::ostream& output, CellRange range) const {
+    if (!range.IsValid()) {
+        throw InvalidPositionException("PrintValues ERROR: InvalidRange.");
+    }
+    PrintCells(output, range, true);
+}
+
+void Sheet::PrintTexts(std::ostream& output, CellRange range) const {
+    if (!range.IsValid()) {
+        throw InvalidPositionException("PrintTexts ERROR: InvalidRange.");
+    }
+    PrintCells(output, range, false);
+}
+
+void Sheet::PrintCells(std::ostream& output, CellRange range, bool print_values) const {
+    constexpr int BLOCK_ROWS = 64;
+    // small ranges are not worth waking the workers
+    constexpr long long MIN_PARALLEL_CELLS = 1 << 16;
+
+    if (print_values && evaluation_mode_ == EvaluationMode::Lazy) {
+        // formatting only reads calculated values, so it can be done by any thread
+        storage_.ForEachInRange(range, [](Position, const Cell& cell) {
+            if (!cell.IsCacheValid()) {
+                cell.GetNumericValue();
             }
-            is_first = false;
+        });
+    }
+
+    auto size = range.GetSize();
+    if (thread_pool_ == nullptr || size.rows <= BLOCK_ROWS
+            || static_cast<long long>(size.rows) * size.cols < MIN_PARALLEL_CELLS) {
+        WriteRows(storage_, output, range, print_values);
+        return;
+    }
+
+    // blocks of rows are formatted in rounds of a few per thread, buffers are reused
+    const int block_count = (size.rows + BLOCK_ROWS - 1) / BLOCK_ROWS;
+    std::vector<std::string> buffers(thread_pool_->GetThreadCount() * 4);
+    for (int first_block = 0; first_block < block_count; first_block += static_cast<int>(buffers.size())) {
+        size_t round_size = std::min(buffers.size(), static_cast<size_t>(block_count - first_block));
+        thread_pool_->ParallelFor(round_size, 1, [&](size_t i) {
+            int first_row = range.first.row + (first_block + static_cast<int>(i)) * BLOCK_ROWS;
+            int last_row = std::min(first_row + BLOCK_ROWS - 1, range.last.row);
+            buffers[i].clear();
+            FormatRows(storage_, buffers[i], range, first_row, last_row, print_values);
+        });
+        for (size_t i = 0; i < round_size; ++i) {
+            output.write(buffers[i].data(), buffers[i].size());
         }
-        output << '\n';
     }
 }
 
-void Sheet::PrintTexts(std::ostream& output) const {
+std::vector<std::pair<Position, Cell*>> Sheet::CollectDirtyCells(const std::vector<Position>& roots) {
+    std::vector<std::pair<Position, Cell*>> cells;
+    for (auto pos : roots) {
+        if (auto root = FindCell(pos)) {
+            cells.emplace_back(pos, root);
+        }
+    }
+
+    // dependent formulas reachable from roots, each of them is stored in its own cell
+    std::unordered_set<Position, PositionHasher> visited(roots.begin(), roots.end());
+    std::vector<Position> queue = roots;
+    for (size_t i = 0; i < queue.size(); ++i) {
+        dependencies_.ForEachDependent(queue[i], [&](Position dependent_pos) {
+            if (visited.insert(dependent_pos).second) {
+                queue.push_back(dependent_pos);
+                cells.emplace_back(dependent_pos, FindCell(dependent_pos));
+            }
+        });
+    }
 
-    if (ptr_table_.empty()) {
+    // every cell is ordered before its dependents
+    std::sort(cells.begin(), cells.end(), [](const auto& lhs, const auto& rhs) {
+        return lhs.second->GetOrder() < rhs.second->GetOrder();
+    });
+    return cells;
+}
+
+void Sheet::RecalculateDependents(Position pos) {
+    RecalculateCells(CollectDirtyCells({pos}));
+}
+
+void Sheet::RecalculateCells(const std::vector<std::pair<Position, Cell*>>& cells) {
+    // small changes are not worth waking the workers
+    constexpr size_t MIN_PARALLEL_CELLS = 512;
+
+    if (thread_pool_ != nullptr && cells.size() >= MIN_PARALLEL_CELLS) {
+        RecalculateInParallel(cells);
         return;
     }
+    for (auto [cell_pos, cell] : cells) {
+        cell->Recalculate(*this);
+    }
+}
 
-    for (auto row = 0; row < max_height_; ++row) {
-        bool is_first = true;
-        for (auto col = 0; col < max_width_; ++col) {
-            if (!is_first) {
-                output << '\t';
-            }
-            if (ptr_table_[row].size() > size_t(col) && ptr_table_[row][col] != nullptr) {
-                output << ptr_table_[row][col]->GetText();
+void Sheet::RecalculateInParallel(const std::vector<std::pair<Position, Cell*>>& cells) {
+    // edges between dirty cells, a formula is calculated once all its dirty inputs are
+    std::unordered_map<Position, uint32_t, PositionHasher> indexes;
+    indexes.reserve(cells.size());
+    for (uint32_t i = 0; i < cells.size(); ++i) {
+        indexes.emplace(cells[i].first, i);
+    }
+
+    TaskGraph graph;
+    graph.successor_begin.reserve(cells.size() + 1);
+    graph.input_counts.assign(cells.size(), 0);
+    for (const auto& [pos, cell] : cells) {
+        dependencies_.ForEachDependent(pos, [&](Position dependent_pos) {
+            auto dependent = indexes.find(dependent_pos);
+            if (dependent != indexes.end()) {
+                graph.successors.push_back(dependent->second);
+                ++graph.input_counts[dependent->second];
             }
-            is_first = false;
-        }
-        output << '\n';
+        });
+        graph.successor_begin.push_back(static_cast<uint32_t>(graph.successors.size()));
     }
+
+    TaskScheduler(*thread_pool_).Run(graph, [this, &cells](uint32_t task) {
+        cells[task].second->Recalculate(*this);
+    });
 }
 
-void Sheet::FindAndDecreaseMaxHeightAndWidth() {
-    int height = 0;
-    int width = 0;
-    for (auto row = 0; row < int(ptr_table_.size()); ++row) {
-        int line_max = 0;
-        for (auto col = int(ptr_table_[row].size()); col > 0; --col) {
-            if (ptr_table_[row][col - 1] != nullptr) {
-                line_max = col;
-                height =  row + 1 > height ? row + 1 : height;
-                width =  col > width ? col: width;
-                break;
+void Sheet::InvalidateDependents(Position pos) {
+    // a cell without cache has all its dependents invalidated already
+    std::vector<Position> stack{pos};
+    while (!stack.empty()) {
+        auto current = stack.back();
+        stack.pop_back();
+        dependencies_.ForEachDependent(current, [this, &stack](Position dependent_pos) {
+            auto dependent = FindCell(dependent_pos);
+            if (dependent->IsCacheValid()) {
+                dependent->InvalidateCache();
+                AddDirtyPosition(dependent_pos);
+                stack.push_back(dependent_pos);
             }
+        });
+    }
+}
+
+void Sheet::OnCellChanged(Position pos) {
+    if (evaluation_mode_ == EvaluationMode::Lazy) {
+        AddDirtyPosition(pos);
+        InvalidateDependents(pos);
+    } else {
+        RecalculateDependents(pos);
+    }
+}
+
+void Sheet::AddDirtyPosition(Position pos) {
+    if (dirty_positions_.size() == dirty_positions_.capacity()) {
+        // formulas calculated by reads since are dropped before the list grows
+        dirty_positions_.erase(std::remove_if(dirty_positions_.begin(), dirty_positions_.end(),
+                                              [this](Position dirty_pos) {
+                                                  auto cell = std::as_const(*this).FindCell(dirty_pos);
+                                                  return cell == nullptr || cell->IsCacheValid();
+                                              }),
+                               dirty_positions_.end());
+    }
+    dirty_positions_.push_back(pos);
+}
+
+void Sheet::CalculateDirtyCells() {
+    for (auto pos : dirty_positions_) {
+        auto cell = std::as_const(*this).FindCell(pos);
+        if (cell != nullptr && !cell->IsCacheValid()) {
+            cell->GetNumericValue();
         }
-        ptr_table_[row].resize(line_max);
     }
-    ptr_table_.resize(height + 1);
+    dirty_positions_.clear();
+}
+
+void Sheet::SetEvaluationMode(EvaluationMode mode) {
+    if (mode == EvaluationMode::Eager && evaluation_mode_ == EvaluationMode::Lazy) {
+        // eager recalculation expects every formula out of the changed cone to be clean
+        CalculateDirtyCells();
+    }
+    evaluation_mode_ = mode;
+}
+
+SheetView Sheet::CreateView() {
+    // views are read by other threads, so nothing is left to calculate in shared cells
+    CalculateDirtyCells();
+    return SheetView(storage_.Share(), GetPrintableSize());
+}
+
+void Sheet::SetConcurrentReads(bool enabled) {
+    concurrent_reads_ = enabled;
+    published_view_.Publish(enabled ? std::make_shared<const SheetView>(CreateView()) : nullptr);
+}
+
+bool Sheet::HasConcurrentReads() const {
+    return concurrent_reads_;
+}
+
+std::shared_ptr<const SheetView> Sheet::GetPublishedView() const {
+    return published_view_.Load();
+}
+
+void Sheet::PublishView() {
+    if (concurrent_reads_) {
+        published_view_.Publish(std::make_shared<const SheetView>(CreateView()));
+    }
+}
 
-    max_width_ = width;
-    max_height_ = height;
+void Sheet::SetJournal(EditJournal* journal) {
+    journal_ = journal;
+}
 
+Sheet::EvaluationMode Sheet::GetEvaluationMode() const {
+    return evaluation_mode_;
 }
 
+void Sheet::SetThreadCount(size_t count) {
+    if (count == GetThreadCount()) {
+        return;
+    }
+    thread_pool_ = count > 1 ? std::make_unique<ThreadPool>(count) : nullptr;
+}
+
+size_t Sheet::GetThreadCount() const {
+    return thread_pool_ != nullptr ? thread_pool_->GetThreadCount() : 1;
+}
 
 std::unique_ptr<SheetInterface> CreateSheet() {
     return std::make_unique<Sheet>();
 }
 
 
-bool Sheet::FindCyclicDependencies(const std::vector<Position>& previous_cells, Position pos) const {
-
-    if (previous_cells.empty()) {
+bool Sheet::HasCircularDependency(Position pos, const std::vector<CellRange>& referenced) const {
+    for (const auto& range : referenced) {
+        if (range.Contains(pos)) {
+            return true;
+        }
+    }
+    // a new cell gets its order in SetCell(), nothing can be reached from it without dependents
+    if (!dependencies_.HasDependents(pos)) {
         return false;
     }
-
-    if (std::find(previous_cells.begin(), previous_cells.end(), pos) != previous_cells.end()) {
-        return true;
+    auto cell = FindCell(pos);
+    int order = cell != nullptr ? cell->GetOrder() : min_order_ - 1;
+
+    // Only referenced cells placed after pos in topological order can be reached from it
+    int upper_bound = order;
+    for (const auto& range : referenced) {
+        storage_.ForEachInRange(range, [&upper_bound](Position, const Cell& ref) {
+            upper_bound = std::max(upper_bound, ref.GetOrder());
+        });
+    }
+    if (upper_bound == order) {
+        return false;
     }
 
-    for (const auto& i : previous_cells) {
-        auto ptr = GetCell(i);
-        if (ptr != nullptr) {
-            bool result = FindCyclicDependencies( ptr->GetReferencedCells(), pos);
-            if (result) {
-                return true;
+    // search is limited to cells between pos and the farthest referenced one
+    bool is_cycle = false;
+    std::unordered_set<Position, PositionHasher> visited{pos};
+    std::vector<Position> stack{pos};
+    while (!stack.empty() && !is_cycle) {
+        auto current = stack.back();
+        stack.pop_back();
+        dependencies_.ForEachDependent(current, [&](Position dependent_pos) {
+            if (is_cycle || FindCell(dependent_pos)->GetOrder() > upper_bound) {
+                return;
             }
+            for (const auto& range : referenced) {
+                if (range.Contains(dependent_pos)) {
+                    is_cycle = true;
+                    return;
+                }
+            }
+            if (visited.insert(dependent_pos).second) {
+                stack.push_back(dependent_pos);
+            }
+        });
+    }
+    return is_cycle;
+}
+
+void Sheet::RestoreTopologicalOrder(Position from, Position to) {
+    // Pearce-Kelly: new edge from -> to breaks the order, so cells reachable from "to"
+    // and cells reaching "from" inside the affected region swap their places
+    const int lower_bound = FindCell(to)->GetOrder();
+    const int upper_bound = FindCell(from)->GetOrder();
+
+    auto collect = [this](Position start, auto&& for_each_next, auto&& in_region) {
+        std::vector<Position> region{start};
+        std::unordered_set<Position, PositionHasher> visited{start};
+        for (size_t i = 0; i < region.size(); ++i) {
+            for_each_next(region[i], [&](Position next_pos) {
+                // only read here, cells to be reordered are taken for change below
+                auto next = std::as_const(*this).FindCell(next_pos);
+                if (next != nullptr && in_region(next) && visited.insert(next_pos).second) {
+                    region.push_back(next_pos);
+                }
+            });
+        }
+
+        std::vector<Cell*> cells;
+        cells.reserve(region.size());
+        for (auto region_pos : region) {
+            cells.push_back(FindCell(region_pos));
+        }
+        return cells;
+    };
+
+    auto forward = collect(
+            to,
+            [this](Position pos, auto&& visit) {
+                dependencies_.ForEachDependent(pos, visit);
+            },
+            [upper_bound](const Cell* cell) { return cell->GetOrder() < upper_bound; });
+    auto backward = collect(
+            from,
+            [this](Position pos, auto&& visit) {
+                for (const auto& range : std::as_const(*this).FindCell(pos)->GetReferencedRanges()) {
+                    storage_.ForEachInRange(range, [&visit](Position precedent_pos, const Cell&) {
+                        visit(precedent_pos);
+                    });
+                }
+            },
+            [lower_bound](const Cell* cell) { return cell->GetOrder() > lower_bound; });
+
+    auto by_order = [](const Cell* lhs, const Cell* rhs) {
+        return lhs->GetOrder() < rhs->GetOrder();
+    };
+    std::sort(forward.begin(), forward.end(), by_order);
+    std::sort(backward.begin(), backward.end(), by_order);
+
+    std::vector<int> orders;
+    orders.reserve(forward.size() + backward.size());
+    for (auto cells : {&backward, &forward}) {
+        for (const Cell* cell : *cells) {
+            orders.push_back(cell->GetOrder());
         }
     }
+    std::sort(orders.begin(), orders.end());
 
-    return false;
-}
\ No newline at end of file
+    auto order = orders.begin();
+    for (auto cells : {&backward, &forward}) {
+        for (Cell* cell : *cells) {
+            cell->SetOrder(*order++);
+        }
+    }
+}
@@ -2,36 +2,246 @@
 
 #include "cell.h"
 #include "common.h"
+#include "dependency_index.h"
+#include "formula.h"
+#include "journal.h"
+#include "published_ptr.h"
+#include "storage.h"
+#include "task_scheduler.h"
+#include "thread_pool.h"
 
 #include <functional>
+#include <memory>
+#include <optional>
+#include <unordered_set>
+#include <utility>
+
+// Immutable state of a sheet at the moment it was taken, see Sheet::CreateView().
+// Cells are shared with the sheet until it changes them, so a view is cheap to take
+// and to keep. Any number of threads may read a view while the sheet is edited
+class SheetView {
+public:
+    // Cell in pos as Sheet::GetCell() returned it when the view was taken: an empty
+    // cell for positions referenced by formulas without a cell, nullptr for others.
+    // Throws InvalidPositionException if pos is invalid
+    const CellInterface* GetCell(Position pos) const;
+    Size GetPrintableSize() const;
+
+    void PrintValues(std::ostream& output) const;
+    void PrintTexts(std::ostream& output) const;
+
+private:
+    friend class Sheet;
+
+    SheetView(CellStorage storage, Size printable_size);
+
+    // References of formulas of the view, indexed by the first reader asking for a
+    // position without a cell
+    const DependencyIndex& GetDependencies() const;
+
+    CellStorage storage_;
+    Size printable_size_;
+    // returned by GetCell() for referenced positions without a cell
+    Cell empty_cell_;
+    // accessed with std::atomic_load() and std::atomic_compare_exchange_strong(),
+    // the index of the first reader to finish is kept
+    mutable std::shared_ptr<const DependencyIndex> dependencies_;
+};
 
 class Sheet : public SheetInterface {
 public:
+    enum class EvaluationMode {
+        Eager,  // dependent formulas are recalculated on every change
+        Lazy,   // dependent formulas are only invalidated and calculated on read
+    };
+
+    // Edit of SetCells() that was not applied
+    struct CellError {
+        enum class Reason {
+            InvalidPosition,     // SetCell() would throw InvalidPositionException
+            InvalidFormula,      // FormulaException
+            CircularDependency,  // CircularDependencyException
+        };
+
+        size_t index;  // of the edit in the batch
+        Position pos;
+        Reason reason;
+    };
+
     ~Sheet();
 
     void SetCell(Position pos, std::string text) override;
+    // Sets texts of many cells at once. Formulas are parsed by the threads set with
+    // SetThreadCount() and the dependency graph is updated for the whole batch, then
+    // every affected formula is recalculated once. The last edit of a position wins,
+    // the one before it is applied instead if it's skipped for a cycle.
+    // Edits SetCell() would throw on are skipped and reported in the order of the
+    // batch, for cycles these are all edited formulas on them. Other edits are applied
+    std::vector<CellError> SetCells(std::vector<std::pair<Position, std::string>> edits);
+    // Same for texts in memory kept by the caller until the call returns, such as a
+    // mapped file. Only texts of cells that are set are copied
+    std::vector<CellError> SetCellsFromViews(std::vector<std::pair<Position, std::string_view>> edits);
 
     const CellInterface* GetCell(Position pos) const override;
     CellInterface* GetCell(Position pos) override;
 
+    // Cell lookup for formula evaluation: pos is expected to be valid, no checks
+    // and casts are made
+    const Cell* FindCell(Position pos) const;
+    Cell* FindCell(Position pos);
+    // Calls func(Position, const Cell&) for stored cells inside range
+    template <typename Func>
+    void ForEachCellInRange(CellRange range, Func&& func) const {
+        storage_.ForEachInRange(range, std::forward<Func>(func));
+    }
+    // Appends numbers of range cells for functions over ranges, see Cell::GetRangeValue().
+    // Returns the first error met
+    std::optional<FormulaError> CollectNumbers(CellRange range, std::vector<double>& numbers) const;
+
     void ClearCell(Position pos) override;
+    // Clears every cell of range as ClearCell() does, dependent formulas are
+    // recalculated once for all of them. Throws InvalidPositionException if range
+    // is invalid
+    void ClearRange(CellRange range);
 
     Size GetPrintableSize() const override;
 
     void PrintValues(std::ostream& output) const override;
     void PrintTexts(std::ostream& output) const override;
+    // Same for cells of range only, rows have range width. Numbers are formatted
+    // as by std::ostream with default settings
+    void PrintValues(std::ostream& output, CellRange range) const;
+    void PrintTexts(std::ostream& output, CellRange range) const;
+
+    // Checks if formula in pos referencing given ranges closes a cycle. Uses topological
+    // order of cells, so only the region between pos and referenced cells is visited
+    bool HasCircularDependency(Position pos, const std::vector<CellRange>& referenced) const;
+
+    // Binary snapshot of cells with parsed formulas in canonical form, their
+    // topological order and calculated values, see snapshot.cpp for the layout
+    void SaveSnapshot(std::ostream& output) const;
+    // Fills the empty sheet from a snapshot and takes its evaluation mode without
+    // recalculating anything, formulas are parsed by the threads set with
+    // SetThreadCount(). Throws SnapshotException leaving the sheet empty if data
+    // is not a snapshot of this version or is damaged
+    void LoadSnapshot(std::string_view data);
+
+    // View of the current state of cells for readers on other threads. Takes O(1) in
+    // Eager mode, in Lazy mode formulas left dirty are calculated first. The first
+    // change of a tile of cells after that copies it, so cells returned by GetCell()
+    // before the change may go away with the views sharing them
+    SheetView CreateView();
+
+    // In concurrent mode a view is published after every change of cells for readers
+    // on other threads, see GetPublishedView(). Changes copy the tiles they touch then,
+    // and dirty formulas are calculated before publication in Lazy mode too
+    void SetConcurrentReads(bool enabled);
+    bool HasConcurrentReads() const;
+    // The view published last, nullptr out of concurrent mode. Unlike other methods,
+    // it may be called by any number of threads while one thread changes the sheet.
+    // No locks are taken, the view stays valid while it's held
+    std::shared_ptr<const SheetView> GetPublishedView() const;
 
-    // Recursive search for pos in Formula GetReferencedCells() for non-existing cell before creating cell
-    // cause Formula can be incorrect;
-    bool FindCyclicDependencies(const std::vector<Position>& previous_cells, Position pos) const;
+    // Successful edits of cells are logged to the journal from now on, nullptr stops
+    // logging. The journal is not owned by the sheet
+    void SetJournal(EditJournal* journal);
+
+    // Switching to Eager mode calculates formulas left dirty by Lazy mode
+    void SetEvaluationMode(EvaluationMode mode);
+    EvaluationMode GetEvaluationMode() const;
+
+    // Number of threads recalculating formulas in Eager mode, 1 by default.
+    // Formulas not depending on each other are calculated concurrently, results
+    // are the same for any number of threads
+    void SetThreadCount(size_t count);
+    size_t GetThreadCount() const;
 
 private:
-    // Можете дополнить ваш класс нужными полями и методами
-    using Table = std::vector<std::vector<std::unique_ptr<CellInterface>>>;
-    Table ptr_table_;
+    CellStorage storage_{*this};
+    // formulas referencing each position, referenced cells don't have to exist
+    DependencyIndex dependencies_;
+    // returned by GetCell() for referenced positions without a cell
+    Cell empty_cell_;
 
     int max_width_ = 0;
     int max_height_ = 0;
+    // numbers of stored cells in every row and column, the printable size is
+    // shrunk by them when cells are cleared
+    std::vector<int> row_counts_;
+    std::vector<int> col_counts_;
+
+    EvaluationMode evaluation_mode_ = EvaluationMode::Eager;
+
+    // identical formulas of different cells share one parsed object
+    FormulaCache formula_cache_;
+
+    // bounds of orders given to cells, see Cell::GetOrder()
+    int min_order_ = 0;
+    int max_order_ = 0;
+
+    // workers for parallel recalculation, none when a single thread is used
+    std::unique_ptr<ThreadPool> thread_pool_;
+
+    EditJournal* journal_ = nullptr;
+
+    // positions of formulas invalidated in Lazy mode since the last CalculateDirtyCells(),
+    // some of them may have been calculated by reads or cleared since
+    std::vector<Position> dirty_positions_;
+
+    bool concurrent_reads_ = false;
+    PublishedPtr<SheetView> published_view_;
+
+    // Edit of SetCells() being applied, its text stays in the edits at index until
+    // it's set to the cell
+    struct PendingEdit {
+        size_t index;
+        Position pos;
+        std::shared_ptr<const FormulaInterface> formula;
+    };
+
+    // SetCells() for texts of type Text, std::string or std::string_view
+    template <typename Text>
+    std::vector<CellError> ApplyEdits(std::vector<std::pair<Position, Text>>& edits);
+
+    Cell* CreateCell(Position pos, int order);
+    // Removes the cell in pos and its dependencies, dependents are not refreshed
+    void EraseCell(Position pos);
+    // Drops empty rows and columns at the end of the printable area
+    void ShrinkPrintableSize();
+
+    // Parses expressions on the threads of thread_pool_, invalid ones give nullptr
+    std::vector<std::shared_ptr<const FormulaInterface>> ParseFormulas(
+            const std::vector<std::string_view>& expressions) const;
+
+    // Edited positions and formulas (transitively) depending on them in topological
+    // order of the graph with edits applied. Returns nothing if the edits make cycles,
+    // indexes of edits closing them are put to cyclic
+    std::optional<std::vector<Position>> SortEditedCells(const std::vector<PendingEdit>& edits,
+                                                         std::vector<size_t>& cyclic) const;
+
+    // Called after dependency from -> to is added while from is ordered after to
+    void RestoreTopologicalOrder(Position from, Position to);
+
+    // Cells in roots if any and formulas that (transitively) depend on them in topological order
+    std::vector<std::pair<Position, Cell*>> CollectDirtyCells(const std::vector<Position>& roots);
+    // Recalculates cell in pos and every its dependent exactly once
+    void RecalculateDependents(Position pos);
+    // Same for cells in topological order
+    void RecalculateCells(const std::vector<std::pair<Position, Cell*>>& cells);
+    // Same in parallel, formulas are calculated by threads of
+    // thread_pool_ as soon as their inputs are ready, see TaskScheduler
+    void RecalculateInParallel(const std::vector<std::pair<Position, Cell*>>& cells);
+    // Drops cached values of cell in pos and its dependents, stops at already invalid ones
+    void InvalidateDependents(Position pos);
+    // Reacts on a change of the cell in pos according to evaluation_mode_
+    void OnCellChanged(Position pos);
+    void AddDirtyPosition(Position pos);
+    // Calculates formulas left dirty by Lazy mode
+    void CalculateDirtyCells();
+    // Publishes the current state of cells in concurrent mode
+    void PublishView();
 
-    void FindAndDecreaseMaxHeightAndWidth();
+    // Writes values or texts of range cells. Rows are formatted into buffers, in
+    // blocks by threads of thread_pool_ for large ranges, and written in order
+    void PrintCells(std::ostream& output, CellRange range, bool print_values) const;
 };
\ No newline at end of file
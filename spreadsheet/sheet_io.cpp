@@ -0,0 +1,134 @@
+#include "sheet_io.h"
+
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <deque>
+#include <fstream>
+#include <stdexcept>
+#include <utility>
+
+namespace {
+    // fields are views into the data, so only texts of cells set are copied
+    using Edits = std::vector<std::pair<Position, std::string_view>>;
+
+    void ReadTsv(std::string_view data, Edits& edits) {
+        for (int row = 0; !data.empty(); ++row) {
+            size_t line_end = data.find('\n');
+            std::string_view line = data.substr(0, line_end);
+            data.remove_prefix(line_end == data.npos ? data.size() : line_end + 1);
+            if (!line.empty() && line.back() == '\r') {
+                line.remove_suffix(1);
+            }
+
+            for (int col = 0;; ++col) {
+                size_t field_end = line.find('\t');
+                std::string_view field = line.substr(0, field_end);
+                if (!field.empty()) {
+                    edits.emplace_back(Position{row, col}, field);
+                }
+                if (field_end == line.npos) {
+                    break;
+                }
+                line.remove_prefix(field_end + 1);
+            }
+        }
+    }
+
+    // Fields that are not a part of the data as they are, quoted ones with doubled
+    // quotes or text after the closing quote, are put together in unescaped
+    void ReadCsv(std::string_view data, Edits& edits, std::deque<std::string>& unescaped) {
+        int row = 0;
+        int col = 0;
+        size_t i = 0;
+        while (i < data.size()) {
+            std::string_view text;
+            std::string* copy = nullptr;
+            auto append = [&](std::string_view part) {
+                if (part.empty()) {
+                    return;
+                }
+                if (text.empty()) {
+                    text = part;
+                    return;
+                }
+                if (copy == nullptr) {
+                    copy = &unescaped.emplace_back(text);
+                }
+                copy->append(part);
+                text = *copy;
+            };
+
+            if (data[i] == '"') {
+                // quoted part ends with a single quote, doubled ones stand for a quote
+                ++i;
+                for (;;) {
+                    size_t quote = data.find('"', i);
+                    append(data.substr(i, quote - i));
+                    if (quote == data.npos) {
+                        i = data.size();
+                        break;
+                    }
+                    i = quote + 1;
+                    if (i == data.size() || data[i] != '"') {
+                        break;
+                    }
+                    append(data.substr(i, 1));
+                    ++i;
+                }
+            }
+
+            // unquoted text up to the end of the field
+            size_t field_end = std::min(data.find_first_of(",\n", i), data.size());
+            std::string_view rest = data.substr(i, field_end - i);
+            if (!rest.empty() && rest.back() == '\r' && (field_end == data.size() || data[field_end] == '\n')) {
+                rest.remove_suffix(1);
+            }
+            append(rest);
+            if (!text.empty()) {
+                edits.emplace_back(Position{row, col}, text);
+            }
+
+            i = field_end + 1;
+            if (field_end < data.size() && data[field_end] == ',') {
+                ++col;
+            } else {
+                ++row;
+                col = 0;
+            }
+        }
+    }
+}  // namespace
+
+std::vector<Sheet::CellError> ImportTexts(Sheet& sheet, std::string_view data, TextFormat format) {
+    Edits edits;
+    std::deque<std::string> unescaped;
+    if (format == TextFormat::Tsv) {
+        ReadTsv(data, edits);
+    } else {
+        ReadCsv(data, edits, unescaped);
+    }
+    return sheet.SetCellsFromViews(std::move(edits));
+}
+
+std::vector<Sheet::CellError> ImportTextsFromFile(Sheet& sheet, const std::string& path, TextFormat format) {
+    MappedFile file(path);
+    return ImportTexts(sheet, file.GetData(), format);
+}
+
+void SaveSnapshotToFile(const Sheet& sheet, const std::string& path) {
+    std::ofstream output(path, std::ios::binary);
+    if (!output) {
+        throw std::runtime_error("Can't open " + path);
+    }
+    sheet.SaveSnapshot(output);
+    output.close();
+    if (!output) {
+        throw std::runtime_error("Can't write " + path);
+    }
+}
+
+void LoadSnapshotFromFile(Sheet& sheet, const std::string& path) {
+    MappedFile file(path);
+    sheet.LoadSnapshot(file.GetData());
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "sheet.h"
+
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Layout of cell texts in a file, one row of the sheet per line
+enum class TextFormat {
+    Tsv,  // fields separated by tabs as written by Sheet::PrintTexts(), no quoting
+    Csv,  // fields separated by commas, ones with commas, quotes or line breaks
+          // are quoted with quotes inside doubled
+};
+
+// Sets cells of the sheet from rows of texts, the first field of the first row goes
+// to A1. Empty fields leave cells as they are. Everything is committed by a single
+// Sheet::SetCellsFromViews() with fields viewing data, so formulas are parsed by the
+// threads of the sheet and only texts of cells set are copied. Its errors are
+// returned, edits are indexed in the order of non-empty fields in data
+std::vector<Sheet::CellError> ImportTexts(Sheet& sheet, std::string_view data,
+                                          TextFormat format = TextFormat::Tsv);
+
+// Same for a file mapped to memory, throws std::runtime_error if it can't be read
+std::vector<Sheet::CellError> ImportTextsFromFile(Sheet& sheet, const std::string& path,
+                                                  TextFormat format = TextFormat::Tsv);
+
+// Sheet::SaveSnapshot() to a file, throws std::runtime_error if it can't be written
+void SaveSnapshotToFile(const Sheet& sheet, const std::string& path);
+// Sheet::LoadSnapshot() of a file mapped to memory, throws std::runtime_error if it
+// can't be read
+void LoadSnapshotFromFile(Sheet& sheet, const std::string& path);
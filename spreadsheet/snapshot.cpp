@@ -0,0 +1,273 @@
+#include "sheet.h"
+
+#include <cstdint>
+#include <cstring>
+#include <ostream>
+#include <unordered_map>
+
+// Snapshot layout, numbers are in the byte order of the saving machine and sections
+// start at offsets aligned by 8 bytes, so a mapped file is read in place:
+//
+//   Header
+//   CellRecord[cell_count]        stored cells
+//   FormulaRecord[formula_count]  distinct formulas shared by cells
+//   char[string_bytes]            texts of cells and expressions of formulas
+//
+// Formulas are kept as canonical expressions parsed again on load. Cells have their
+// positions in topological order, so neither the dependency graph has to be sorted
+// nor values calculated.
+namespace {
+    constexpr char SNAPSHOT_MAGIC[8] = {'S', 'H', 'E', 'E', 'T', 'S', 'N', 'P'};
+    constexpr uint32_t SNAPSHOT_VERSION = 1;
+    // stored as is, so a snapshot of a machine with other byte order is rejected
+    constexpr uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t evaluation_mode;
+        uint32_t reserved;
+        uint64_t cell_count;
+        uint64_t formula_count;
+        uint64_t string_bytes;
+    };
+
+    enum class CellKind : uint8_t {
+        Text,     // empty cells are texts of zero length
+        Formula,
+    };
+
+    enum class ValueKind : uint8_t {
+        None,     // not a formula or not calculated
+        Number,
+        Error,
+    };
+
+    struct CellRecord {
+        int32_t row;
+        int32_t col;
+        int32_t order;
+        CellKind kind;
+        ValueKind value_kind;
+        uint8_t error_category;
+        uint8_t reserved;
+        uint64_t text_offset;  // text cells
+        uint32_t text_size;
+        uint32_t formula;      // index of the formula of formula cells
+        double number;         // value of a formula with ValueKind::Number
+    };
+
+    struct FormulaRecord {
+        uint64_t expression_offset;
+        uint64_t expression_size;
+    };
+
+    static_assert(sizeof(Header) == 48 && sizeof(CellRecord) == 40 && sizeof(FormulaRecord) == 16,
+                  "records are expected to have no padding");
+
+    constexpr size_t Align(size_t offset) {
+        return (offset + 7) / 8 * 8;
+    }
+
+    void WritePadded(std::ostream& output, const void* data, size_t size) {
+        static constexpr char zeros[8] = {};
+        output.write(static_cast<const char*>(data), size);
+        output.write(zeros, Align(size) - size);
+    }
+
+    // Fixed-size records read with memcpy, the mapping doesn't have to be aligned
+    template <typename Record>
+    Record ReadRecord(std::string_view data, size_t offset) {
+        Record record;
+        std::memcpy(&record, data.data() + offset, sizeof(Record));
+        return record;
+    }
+}  // namespace
+
+void Sheet::SaveSnapshot(std::ostream& output) const {
+    std::vector<CellRecord> cells;
+    std::vector<FormulaRecord> formulas;
+    std::string strings;
+    std::unordered_map<const FormulaInterface*, uint32_t> formula_indexes;
+
+    storage_.ForEach([&](Position pos, const Cell& cell) {
+        CellRecord record{};
+        record.row = pos.row;
+        record.col = pos.col;
+        record.order = cell.GetOrder();
+
+        if (auto formula = cell.GetParsedFormula()) {
+            record.kind = CellKind::Formula;
+            auto [it, is_new] = formula_indexes.emplace(formula, static_cast<uint32_t>(formulas.size()));
+            if (is_new) {
+                auto expression = formula->GetExpression();
+                formulas.push_back({strings.size(), expression.size()});
+                strings += expression;
+            }
+            record.formula = it->second;
+
+            if (auto value = cell.GetCachedValue()) {
+                if (auto number = std::get_if<double>(&*value)) {
+                    record.value_kind = ValueKind::Number;
+                    record.number = *number;
+                } else {
+                    record.value_kind = ValueKind::Error;
+                    record.error_category = static_cast<uint8_t>(std::get<FormulaError>(*value).GetCategory());
+                }
+            }
+        } else {
+            record.kind = CellKind::Text;
+            auto text = cell.GetText();
+            record.text_offset = strings.size();
+            record.text_size = static_cast<uint32_t>(text.size());
+            strings += text;
+        }
+        cells.push_back(record);
+    });
+
+    Header header{};
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = SNAPSHOT_VERSION;
+    header.byte_order = BYTE_ORDER_MARK;
+    header.evaluation_mode = static_cast<uint32_t>(evaluation_mode_);
+    header.cell_count = cells.size();
+    header.formula_count = formulas.size();
+    header.string_bytes = strings.size();
+
+    WritePadded(output, &header, sizeof(header));
+    WritePadded(output, cells.data(), cells.size() * sizeof(CellRecord));
+    WritePadded(output, formulas.data(), formulas.size() * sizeof(FormulaRecord));
+    WritePadded(output, strings.data(), strings.size());
+}
+
+void Sheet::LoadSnapshot(std::string_view data) {
+    if (!(GetPrintableSize() == Size{})) {
+        throw SnapshotException("LoadSnapshot ERROR: Sheet is not empty.");
+    }
+
+    if (data.size() < sizeof(Header)) {
+        throw SnapshotException("LoadSnapshot ERROR: Truncated header.");
+    }
+    auto header = ReadRecord<Header>(data, 0);
+    if (std::memcmp(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0) {
+        throw SnapshotException("LoadSnapshot ERROR: Not a snapshot.");
+    }
+    if (header.version != SNAPSHOT_VERSION || header.byte_order != BYTE_ORDER_MARK) {
+        throw SnapshotException("LoadSnapshot ERROR: Unsupported version.");
+    }
+    if (header.evaluation_mode > static_cast<uint32_t>(EvaluationMode::Lazy)) {
+        throw SnapshotException("LoadSnapshot ERROR: Bad evaluation mode.");
+    }
+
+    // sizes are checked one by one, so offsets can't overflow
+    const size_t cells_offset = Align(sizeof(Header));
+    if (header.cell_count > (data.size() - cells_offset) / sizeof(CellRecord)) {
+        throw SnapshotException("LoadSnapshot ERROR: Truncated cells.");
+    }
+    const size_t formulas_offset = cells_offset + Align(header.cell_count * sizeof(CellRecord));
+    if (formulas_offset > data.size()
+            || header.formula_count > (data.size() - formulas_offset) / sizeof(FormulaRecord)) {
+        throw SnapshotException("LoadSnapshot ERROR: Truncated formulas.");
+    }
+    const size_t strings_offset = formulas_offset + Align(header.formula_count * sizeof(FormulaRecord));
+    if (strings_offset > data.size() || header.string_bytes > data.size() - strings_offset) {
+        throw SnapshotException("LoadSnapshot ERROR: Truncated strings.");
+    }
+    const std::string_view strings = data.substr(strings_offset, header.string_bytes);
+
+    auto get_string = [&strings](uint64_t offset, uint64_t size) {
+        if (offset > strings.size() || size > strings.size() - offset) {
+            throw SnapshotException("LoadSnapshot ERROR: Bad string.");
+        }
+        return strings.substr(offset, size);
+    };
+
+    std::vector<std::string_view> expressions;
+    expressions.reserve(header.formula_count);
+    for (size_t i = 0; i < header.formula_count; ++i) {
+        auto record = ReadRecord<FormulaRecord>(data, formulas_offset + i * sizeof(FormulaRecord));
+        expressions.push_back(get_string(record.expression_offset, record.expression_size));
+    }
+    auto formulas = ParseFormulas(expressions);
+    for (const auto& formula : formulas) {
+        if (formula == nullptr) {
+            throw SnapshotException("LoadSnapshot ERROR: Bad formula.");
+        }
+    }
+
+    try {
+        bool is_first = true;
+        for (size_t i = 0; i < header.cell_count; ++i) {
+            auto record = ReadRecord<CellRecord>(data, cells_offset + i * sizeof(CellRecord));
+            Position pos{record.row, record.col};
+            if (!pos.IsValid() || FindCell(pos) != nullptr) {
+                throw SnapshotException("LoadSnapshot ERROR: Bad cell position.");
+            }
+
+            auto cell = CreateCell(pos, record.order);
+            min_order_ = is_first ? record.order : std::min(min_order_, record.order);
+            max_order_ = is_first ? record.order : std::max(max_order_, record.order);
+            is_first = false;
+
+            if (record.kind == CellKind::Text) {
+                auto text = get_string(record.text_offset, record.text_size);
+                // a formula would be parsed with references and order left unchecked
+                if (text.size() > 1 && text[0] == FORMULA_SIGN) {
+                    throw SnapshotException("LoadSnapshot ERROR: Bad text.");
+                }
+                cell->Set(std::string(text));
+                continue;
+            }
+            if (record.kind != CellKind::Formula || record.formula >= formulas.size()) {
+                throw SnapshotException("LoadSnapshot ERROR: Bad cell.");
+            }
+
+            cell->SetFormula(formulas[record.formula]);
+            for (const auto& range : cell->GetReferencedRanges()) {
+                dependencies_.Add(range, pos);
+            }
+            if (record.value_kind == ValueKind::Number) {
+                cell->SetCachedValue(record.number);
+            } else if (record.value_kind == ValueKind::Error) {
+                if (record.error_category > static_cast<uint8_t>(FormulaError::Category::Div0)) {
+                    throw SnapshotException("LoadSnapshot ERROR: Bad value.");
+                }
+                cell->SetCachedValue(FormulaError(static_cast<FormulaError::Category>(record.error_category)));
+            } else if (record.value_kind == ValueKind::None) {
+                AddDirtyPosition(pos);
+            } else {
+                throw SnapshotException("LoadSnapshot ERROR: Bad value.");
+            }
+        }
+
+        // every formula is ordered after the cells it references, so there are no cycles
+        storage_.ForEach([this](Position, const Cell& cell) {
+            for (const auto& range : cell.GetReferencedRanges()) {
+                storage_.ForEachInRange(range, [&cell](Position, const Cell& referenced) {
+                    if (referenced.GetOrder() >= cell.GetOrder()) {
+                        throw SnapshotException("LoadSnapshot ERROR: Bad topological order.");
+                    }
+                });
+            }
+        });
+    } catch (const SnapshotException&) {
+        std::vector<Position> positions;
+        storage_.ForEach([&positions](Position pos, const Cell&) {
+            positions.push_back(pos);
+        });
+        for (auto pos : positions) {
+            EraseCell(pos);
+        }
+        ShrinkPrintableSize();
+        min_order_ = 0;
+        max_order_ = 0;
+        dirty_positions_.clear();
+        throw;
+    }
+
+    // formulas left dirty by Lazy mode are calculated when the sheet is eager
+    evaluation_mode_ = EvaluationMode::Lazy;
+    SetEvaluationMode(static_cast<EvaluationMode>(header.evaluation_mode));
+    PublishView();
+}
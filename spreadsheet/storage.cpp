@@ -0,0 +1,211 @@
+#include "storage.h"
+
+#include "cell.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <new>
+
+namespace {
+    // cells follow the sheet pointer at the start of every chunk
+    constexpr size_t FIRST_CELL_OFFSET = (sizeof(const Sheet*) + alignof(Cell) - 1) / alignof(Cell) * alignof(Cell);
+    constexpr size_t CHUNK_CELLS = (CellStorage::CHUNK_SIZE - FIRST_CELL_OFFSET) / sizeof(Cell);
+    static_assert((CellStorage::CHUNK_SIZE & (CellStorage::CHUNK_SIZE - 1)) == 0, "Chunks are aligned to their size");
+}  // namespace
+
+CellStorage::Arena::Arena(const Sheet& sheet)
+    : sheet_(&sheet)
+    , last_chunk_used_(CHUNK_CELLS)
+{
+}
+
+CellStorage::Arena::~Arena() {
+    for (std::byte* chunk : chunks_) {
+        ::operator delete(chunk, std::align_val_t{CHUNK_SIZE});
+    }
+}
+
+std::unique_lock<std::mutex> CellStorage::Arena::Lock() {
+    if (!is_shared_) {
+        return {};
+    }
+    return std::unique_lock(mutex_);
+}
+
+void* CellStorage::Arena::Allocate() {
+    auto lock = Lock();
+    return AllocateLocked();
+}
+
+void CellStorage::Arena::Allocate(std::vector<void*>& slots, size_t count) {
+    auto lock = Lock();
+    for (size_t i = 0; i < count; ++i) {
+        slots.push_back(AllocateLocked());
+    }
+}
+
+void* CellStorage::Arena::AllocateLocked() {
+    if (!free_slots_.empty()) {
+        void* slot = free_slots_.back();
+        free_slots_.pop_back();
+        return slot;
+    }
+    if (last_chunk_used_ == CHUNK_CELLS) {
+        chunks_.reserve(chunks_.size() + 1);
+        auto chunk = static_cast<std::byte*>(::operator new(CHUNK_SIZE, std::align_val_t{CHUNK_SIZE}));
+        new (chunk) const Sheet*(sheet_);
+        chunks_.push_back(chunk);
+        last_chunk_used_ = 0;
+    }
+    return chunks_.back() + FIRST_CELL_OFFSET + sizeof(Cell) * last_chunk_used_++;
+}
+
+void CellStorage::Arena::Free(void* slot) {
+    auto lock = Lock();
+    free_slots_.push_back(slot);
+}
+
+void CellStorage::Arena::Free(const std::vector<void*>& slots) {
+    auto lock = Lock();
+    free_slots_.insert(free_slots_.end(), slots.begin(), slots.end());
+}
+
+CellStorage::Tile::Tile(std::shared_ptr<Arena> arena)
+    : arena(std::move(arena))
+{
+}
+
+CellStorage::Tile::Tile(const Tile& other)
+    : count(other.count)
+    , arena(other.arena)
+{
+    std::vector<void*> slots;
+    arena->Allocate(slots, count);
+    auto next_slot = slots.begin();
+    for (size_t slot = 0; slot < cells.size(); ++slot) {
+        if (other.cells[slot] != nullptr) {
+            cells[slot] = new (*next_slot++) Cell(*other.cells[slot]);
+        }
+    }
+}
+
+CellStorage::Tile::~Tile() {
+    // slots go back to the arena, its chunks are freed with the last tile
+    std::vector<void*> slots;
+    slots.reserve(count);
+    for (Cell* cell : cells) {
+        if (cell != nullptr) {
+            cell->~Cell();
+            slots.push_back(cell);
+        }
+    }
+    arena->Free(slots);
+}
+
+CellStorage::CellStorage(const Sheet& sheet)
+    : arena_(std::make_shared<Arena>(sheet))
+    , root_(std::make_shared<TileRows>())
+{
+}
+
+CellStorage::CellStorage(std::shared_ptr<Arena> arena, std::shared_ptr<TileRows> root, uint64_t version)
+    : arena_(std::move(arena))
+    , root_(std::move(root))
+    , version_(version)
+{
+}
+
+CellStorage::~CellStorage() = default;
+
+const Sheet& CellStorage::GetSheet(const Cell& cell) {
+    auto chunk = reinterpret_cast<uintptr_t>(&cell) & ~uintptr_t(CHUNK_SIZE - 1);
+    return **reinterpret_cast<const Sheet* const*>(chunk);
+}
+
+CellStorage CellStorage::Share() {
+    arena_->Share();
+    // nodes of the copy are all older than the version, so both storages copy them
+    ++version_;
+    return CellStorage(arena_, root_, version_);
+}
+
+template <typename Node>
+Node& CellStorage::Own(std::shared_ptr<Node>& node) {
+    if (node->version != version_) {
+        node = std::make_shared<Node>(*node);
+        node->version = version_;
+    }
+    return *node;
+}
+
+CellStorage::Tile& CellStorage::OwnTile(Position pos) {
+    size_t tile_row = pos.row / TILE_ROWS;
+    size_t tile_col = pos.col / TILE_COLS;
+
+    auto& rows = Own(root_).rows;
+    if (rows.size() <= tile_row) {
+        rows.resize(tile_row + 1);
+    }
+    if (rows[tile_row] == nullptr) {
+        rows[tile_row] = std::make_shared<TileRow>();
+        rows[tile_row]->version = version_;
+    }
+
+    auto& tiles = Own(rows[tile_row]).tiles;
+    if (tiles.size() <= tile_col) {
+        tiles.resize(tile_col + 1);
+    }
+    if (tiles[tile_col] == nullptr) {
+        tiles[tile_col] = std::make_shared<Tile>(arena_);
+        tiles[tile_col]->version = version_;
+    }
+    return Own(tiles[tile_col]);
+}
+
+Cell* CellStorage::GetMutable(Position pos) {
+    if (Get(pos) == nullptr) {
+        return nullptr;
+    }
+    return OwnTile(pos).cells[SlotIndex(pos)];
+}
+
+Cell* CellStorage::Emplace(Position pos) {
+    auto& tile = OwnTile(pos);
+    auto& slot = tile.cells[SlotIndex(pos)];
+    assert(slot == nullptr);
+    slot = new (arena_->Allocate()) Cell;
+    ++tile.count;
+    return slot;
+}
+
+void CellStorage::Erase(Position pos) {
+    if (Get(pos) == nullptr) {
+        return;
+    }
+
+    auto& tile = OwnTile(pos);
+    auto& slot = tile.cells[SlotIndex(pos)];
+    slot->~Cell();
+    arena_->Free(slot);
+    slot = nullptr;
+    if (--tile.count > 0) {
+        return;
+    }
+
+    // free the tile and trim the directory behind the last used tile,
+    // the path to the tile is owned by this storage already
+    auto& rows = root_->rows;
+    auto& row = rows[pos.row / TILE_ROWS];
+    auto& tiles = row->tiles;
+    tiles[pos.col / TILE_COLS].reset();
+    while (!tiles.empty() && tiles.back() == nullptr) {
+        tiles.pop_back();
+    }
+    if (tiles.empty()) {
+        row.reset();
+    }
+    while (!rows.empty() && rows.back() == nullptr) {
+        rows.pop_back();
+    }
+}
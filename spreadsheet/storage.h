@@ -0,0 +1,216 @@
+#pragma once
+
+#include "common.h"
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class Cell;
+class Sheet;
+
+// Sparse storage of sheet cells. The sheet is split into fixed-size tiles,
+// a tile is allocated with the first cell in it and freed with the last one,
+// so empty areas cost nothing but a null pointer per tile.
+// Cell records themselves are placed in chunks of CHUNK_SIZE bytes shared by the
+// storage and its tiles, slots of erased cells are reused by the next ones.
+// Chunks are aligned to their size and start with the sheet of the storage, so
+// a cell finds its sheet by its address.
+//
+// Rows of tiles and tiles are shared with copies made by Share() and copied
+// on write: the first change of a tile after Share() copies it with its row,
+// so a copy keeps seeing cells as they were when it was made.
+class CellStorage {
+public:
+    static constexpr int TILE_ROWS = 16;
+    static constexpr int TILE_COLS = 16;
+    static constexpr size_t CHUNK_SIZE = 64 * 1024;
+
+    // Empty storage of cells of sheet
+    explicit CellStorage(const Sheet& sheet);
+    ~CellStorage();
+
+    CellStorage(const CellStorage&) = delete;
+    CellStorage& operator=(const CellStorage&) = delete;
+    CellStorage(CellStorage&&) = default;
+    CellStorage& operator=(CellStorage&&) = default;
+
+    // Storage with the same cells in O(1), tiles are copied by this one when changed.
+    // The copy is not expected to be changed, it may be read by other threads
+    // while this storage is changed
+    CellStorage Share();
+
+    // nullptr if there's no cell in pos, pos is expected to be valid
+    const Cell* Get(Position pos) const {
+        size_t tile_row = pos.row / TILE_ROWS;
+        size_t tile_col = pos.col / TILE_COLS;
+        const auto& rows = root_->rows;
+        if (tile_row < rows.size() && rows[tile_row] != nullptr) {
+            const auto& tiles = rows[tile_row]->tiles;
+            if (tile_col < tiles.size() && tiles[tile_col] != nullptr) {
+                return tiles[tile_col]->cells[SlotIndex(pos)];
+            }
+        }
+        return nullptr;
+    }
+    // Same for a cell to be changed, its tile is copied if it's shared
+    Cell* GetMutable(Position pos);
+
+    // Creates an empty cell in empty pos
+    Cell* Emplace(Position pos);
+    void Erase(Position pos);
+
+    // Calls func(Position, const Cell&) for every stored cell
+    template <typename Func>
+    void ForEach(Func&& func) const;
+    // Same for cells inside range, tiles out of it are not visited
+    template <typename Func>
+    void ForEachInRange(CellRange range, Func&& func) const;
+
+    // Sheet of a cell made by any storage
+    static const Sheet& GetSheet(const Cell& cell);
+
+private:
+    // Raw memory of cell records, only the last chunk is partially used. Tiles
+    // shared with copies of the storage may free their cells from other threads,
+    // so slots are taken and given back under a lock once the arena is shared
+    class Arena {
+    public:
+        explicit Arena(const Sheet& sheet);
+        ~Arena();
+
+        // Called before the arena is shared with a copy of the storage. The flag is
+        // set once, as copies made before may read it on other threads
+        void Share() {
+            if (!is_shared_) {
+                is_shared_ = true;
+            }
+        }
+
+        void* Allocate();
+        void Free(void* slot);
+        // Same for many slots of a tile at once
+        void Allocate(std::vector<void*>& slots, size_t count);
+        void Free(const std::vector<void*>& slots);
+
+    private:
+        const Sheet* sheet_;
+        bool is_shared_ = false;
+        std::mutex mutex_;
+        std::vector<std::byte*> chunks_;
+        // slots of the last chunk taken so far
+        size_t last_chunk_used_;
+        std::vector<void*> free_slots_;
+
+        void* AllocateLocked();
+        // Locks mutex_ if the arena is shared, nothing otherwise
+        std::unique_lock<std::mutex> Lock();
+    };
+
+    // Nodes are owned by the storage that made them while their version is its
+    // version_, others may be shared and are copied before a change
+    struct Tile {
+        explicit Tile(std::shared_ptr<Arena> arena);
+        // copies cells to new records
+        Tile(const Tile& other);
+        Tile& operator=(const Tile&) = delete;
+        ~Tile();
+
+        std::array<Cell*, TILE_ROWS * TILE_COLS> cells{};
+        int count = 0;
+        uint64_t version = 0;
+        std::shared_ptr<Arena> arena;
+    };
+
+    struct TileRow {
+        // only as long as the last tile
+        std::vector<std::shared_ptr<Tile>> tiles;
+        uint64_t version = 0;
+    };
+
+    struct TileRows {
+        // only as long as the last row of tiles
+        std::vector<std::shared_ptr<TileRow>> rows;
+        uint64_t version = 0;
+    };
+
+    // Storage sharing arena and root nodes made before version with another one
+    CellStorage(std::shared_ptr<Arena> arena, std::shared_ptr<TileRows> root, uint64_t version);
+
+    static size_t SlotIndex(Position pos) {
+        return (pos.row % TILE_ROWS) * TILE_COLS + pos.col % TILE_COLS;
+    }
+
+    // Node owned by this storage in place of node, copied if it's shared
+    template <typename Node>
+    Node& Own(std::shared_ptr<Node>& node);
+
+    // Tile of pos owned by this storage, created if there's none
+    Tile& OwnTile(Position pos);
+
+    std::shared_ptr<Arena> arena_;
+    std::shared_ptr<TileRows> root_;
+    // bumped by Share(), so every node made before is treated as shared
+    uint64_t version_ = 0;
+};
+
+template <typename Func>
+void CellStorage::ForEach(Func&& func) const {
+    const auto& rows = root_->rows;
+    for (size_t tile_row = 0; tile_row < rows.size(); ++tile_row) {
+        if (rows[tile_row] == nullptr) {
+            continue;
+        }
+        const auto& tiles = rows[tile_row]->tiles;
+        for (size_t tile_col = 0; tile_col < tiles.size(); ++tile_col) {
+            const auto& tile = tiles[tile_col];
+            if (tile == nullptr) {
+                continue;
+            }
+            for (int slot = 0; slot < TILE_ROWS * TILE_COLS; ++slot) {
+                if (tile->cells[slot] != nullptr) {
+                    Position pos{int(tile_row) * TILE_ROWS + slot / TILE_COLS,
+                                 int(tile_col) * TILE_COLS + slot % TILE_COLS};
+                    const Cell& cell = *tile->cells[slot];
+                    func(pos, cell);
+                }
+            }
+        }
+    }
+}
+
+template <typename Func>
+void CellStorage::ForEachInRange(CellRange range, Func&& func) const {
+    const auto& rows = root_->rows;
+    size_t last_tile_row = std::min(size_t(range.last.row / TILE_ROWS) + 1, rows.size());
+    for (size_t tile_row = range.first.row / TILE_ROWS; tile_row < last_tile_row; ++tile_row) {
+        if (rows[tile_row] == nullptr) {
+            continue;
+        }
+        const auto& tiles = rows[tile_row]->tiles;
+        size_t last_tile_col = std::min(size_t(range.last.col / TILE_COLS) + 1, tiles.size());
+        for (size_t tile_col = range.first.col / TILE_COLS; tile_col < last_tile_col; ++tile_col) {
+            const auto& tile = tiles[tile_col];
+            if (tile == nullptr) {
+                continue;
+            }
+            // part of the range inside the tile
+            int first_row = std::max(range.first.row, int(tile_row) * TILE_ROWS);
+            int last_row = std::min(range.last.row, int(tile_row + 1) * TILE_ROWS - 1);
+            int first_col = std::max(range.first.col, int(tile_col) * TILE_COLS);
+            int last_col = std::min(range.last.col, int(tile_col + 1) * TILE_COLS - 1);
+            for (int cell_row = first_row; cell_row <= last_row; ++cell_row) {
+                for (int cell_col = first_col; cell_col <= last_col; ++cell_col) {
+                    Position pos{cell_row, cell_col};
+                    if (const Cell* cell = tile->cells[SlotIndex(pos)]) {
+                        func(pos, *cell);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -1,78 +1,44 @@
 #include "common.h"
 
-#include <cctype>
-#include <sstream>
 #include <algorithm>
 
-const int LETTERS = 26;
-const int MAX_POSITION_LENGTH = 17;
-const int MAX_POS_LETTER_COUNT = 3;
-
 const Position Position::NONE = {-1, -1};
 
-bool Position::operator==(const Position rhs) const {
-    return row == rhs.row && col == rhs.col;
+std::string Position::ToString() const {
+    char buffer[MAX_STRING_LENGTH];
+    return std::string(buffer, ToChars(buffer));
 }
 
-bool Position::operator<(const Position rhs) const {
-    return std::tie(row, col) < std::tie(rhs.row, rhs.col);
+bool Size::operator==(Size rhs) const {
+    return cols == rhs.cols && rows == rhs.rows;
 }
 
-bool Position::IsValid() const {
-    return row >= 0 && col >= 0 && row < MAX_ROWS && col < MAX_COLS;
+bool CellRange::operator==(CellRange rhs) const {
+    return first == rhs.first && last == rhs.last;
 }
 
-std::string Position::ToString() const {
-    if (!IsValid()) {
-        return "";
-    }
-
-    std::string result;
-    result.reserve(MAX_POSITION_LENGTH);
-    int c = col;
-    while (c >= 0) {
-        result.insert(result.begin(), 'A' + c % LETTERS);
-        c = c / LETTERS - 1;
-    }
-
-    result += std::to_string(row + 1);
-
-    return result;
+CellRange CellRange::FromCorners(Position lhs, Position rhs) {
+    return {{std::min(lhs.row, rhs.row), std::min(lhs.col, rhs.col)},
+            {std::max(lhs.row, rhs.row), std::max(lhs.col, rhs.col)}};
 }
 
-Position Position::FromString(std::string_view str) {
-    auto it = std::find_if(str.begin(), str.end(), [](const char c) {
-        return !(std::isalpha(c) && std::isupper(c));
-    });
-    auto letters = str.substr(0, it - str.begin());
-    auto digits = str.substr(it - str.begin());
-
-    if (letters.empty() || digits.empty()) {
-        return Position::NONE;
-    }
-    if (letters.size() > MAX_POS_LETTER_COUNT) {
-        return Position::NONE;
-    }
-
-    if (!std::isdigit(digits[0])) {
-        return Position::NONE;
-    }
-
-    int row;
-    std::istringstream row_in{std::string{digits}};
-    if (!(row_in >> row) || !row_in.eof()) {
-        return Position::NONE;
-    }
+bool CellRange::IsValid() const {
+    return first.IsValid() && last.IsValid() && first.row <= last.row && first.col <= last.col;
+}
 
-    int col = 0;
-    for (char ch : letters) {
-        col *= LETTERS;
-        col += ch - 'A' + 1;
-    }
+bool CellRange::Contains(Position pos) const {
+    return pos.row >= first.row && pos.row <= last.row
+           && pos.col >= first.col && pos.col <= last.col;
+}
 
-    return {row - 1, col - 1};
+Size CellRange::GetSize() const {
+    return {last.row - first.row + 1, last.col - first.col + 1};
 }
 
-bool Size::operator==(Size rhs) const {
-    return cols == rhs.cols && rows == rhs.rows;
+std::string CellRange::ToString() const {
+    char buffer[2 * Position::MAX_STRING_LENGTH + 1];
+    size_t size = first.ToChars(buffer);
+    buffer[size++] = ':';
+    size += last.ToChars(buffer + size);
+    return std::string(buffer, size);
 }
\ No newline at end of file
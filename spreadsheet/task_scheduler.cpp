@@ -0,0 +1,100 @@
+#include "task_scheduler.h"
+
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <thread>
+
+namespace {
+    // Deque of ready tasks of one thread. Owner works at the back, thieves take
+    // from the front, so they get the tasks whose successors are the least likely
+    // to be in the owner's cache.
+    class alignas(64) WorkQueue {
+    public:
+        void Push(uint32_t task) {
+            std::lock_guard lock(mutex_);
+            tasks_.push_back(task);
+        }
+
+        std::optional<uint32_t> Pop() {
+            std::lock_guard lock(mutex_);
+            if (tasks_.empty()) {
+                return std::nullopt;
+            }
+            uint32_t task = tasks_.back();
+            tasks_.pop_back();
+            return task;
+        }
+
+        std::optional<uint32_t> Steal() {
+            std::lock_guard lock(mutex_);
+            if (tasks_.empty()) {
+                return std::nullopt;
+            }
+            uint32_t task = tasks_.front();
+            tasks_.pop_front();
+            return task;
+        }
+
+    private:
+        std::mutex mutex_;
+        std::deque<uint32_t> tasks_;
+    };
+}  // namespace
+
+TaskScheduler::TaskScheduler(ThreadPool& pool)
+    : pool_(pool)
+{
+}
+
+void TaskScheduler::Run(const TaskGraph& graph, const std::function<void(uint32_t)>& run) {
+    const size_t task_count = graph.GetTaskCount();
+    const size_t thread_count = pool_.GetThreadCount();
+
+    auto pending = std::make_unique<std::atomic<uint32_t>[]>(task_count);
+    auto queues = std::make_unique<WorkQueue[]>(thread_count);
+    size_t next_queue = 0;
+    for (uint32_t task = 0; task < task_count; ++task) {
+        pending[task].store(graph.input_counts[task], std::memory_order_relaxed);
+        if (graph.input_counts[task] == 0) {
+            queues[next_queue++ % thread_count].Push(task);
+        }
+    }
+
+    std::atomic<size_t> remaining{task_count};
+    std::atomic<bool> is_failed{false};
+
+    pool_.Run([&](size_t thread) {
+        auto& own = queues[thread];
+        while (remaining.load(std::memory_order_acquire) > 0
+               && !is_failed.load(std::memory_order_relaxed)) {
+            auto task = own.Pop();
+            for (size_t i = 1; !task && i < thread_count; ++i) {
+                task = queues[(thread + i) % thread_count].Steal();
+            }
+            if (!task) {
+                std::this_thread::yield();
+                continue;
+            }
+
+            try {
+                run(*task);
+            } catch (...) {
+                is_failed.store(true, std::memory_order_relaxed);
+                throw;
+            }
+
+            // the last input done makes the successor ready, its acquire-release
+            // decrement publishes results of all inputs to the thread running it
+            for (uint32_t i = graph.successor_begin[*task]; i < graph.successor_begin[*task + 1]; ++i) {
+                uint32_t successor = graph.successors[i];
+                if (pending[successor].fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    own.Push(successor);
+                }
+            }
+            remaining.fetch_sub(1, std::memory_order_release);
+        }
+    });
+}
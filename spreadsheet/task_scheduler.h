@@ -0,0 +1,38 @@
+#pragma once
+
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+// Dependency graph of tasks 0..n-1 in compressed form: successors of task i are
+// successors[successor_begin[i], successor_begin[i + 1]), input_counts[i] is the
+// number of times i is listed as a successor.
+struct TaskGraph {
+    std::vector<uint32_t> successor_begin{0};
+    std::vector<uint32_t> successors;
+    std::vector<uint32_t> input_counts;
+
+    size_t GetTaskCount() const {
+        return input_counts.size();
+    }
+};
+
+// Work-stealing execution of a task graph on the threads of a pool. Every thread
+// keeps a deque of ready tasks and takes the latest one from its back; finishing
+// a task decrements the pending input counters of its successors and pushes the
+// ones becoming ready to the same deque. A thread with an empty deque steals the
+// oldest task from another one, so long chains and wide fans are both balanced
+// without waiting for whole levels of the graph.
+class TaskScheduler {
+public:
+    explicit TaskScheduler(ThreadPool& pool);
+
+    // Calls run(task) for every task after all its inputs are done. Returns when
+    // all tasks are done or rethrows the first exception thrown by run
+    void Run(const TaskGraph& graph, const std::function<void(uint32_t)>& run);
+
+private:
+    ThreadPool& pool_;
+};
@@ -0,0 +1,87 @@
+#include "thread_pool.h"
+
+#include <utility>
+
+ThreadPool::ThreadPool(size_t thread_count) {
+    for (size_t index = 1; index < thread_count; ++index) {
+        workers_.emplace_back([this, index] {
+            WorkerLoop(index);
+        });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard lock(mutex_);
+        is_stopping_ = true;
+    }
+    job_ready_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+}
+
+size_t ThreadPool::GetThreadCount() const {
+    return workers_.size() + 1;
+}
+
+void ThreadPool::Run(const std::function<void(size_t)>& job) {
+    {
+        std::lock_guard lock(mutex_);
+        job_ = &job;
+        ++generation_;
+        running_workers_ = workers_.size();
+        error_ = nullptr;
+    }
+    job_ready_.notify_all();
+
+    try {
+        job(0);
+    } catch (...) {
+        std::lock_guard lock(mutex_);
+        if (!error_) {
+            error_ = std::current_exception();
+        }
+    }
+
+    std::unique_lock lock(mutex_);
+    job_done_.wait(lock, [this] {
+        return running_workers_ == 0;
+    });
+    job_ = nullptr;
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+void ThreadPool::WorkerLoop(size_t index) {
+    size_t done_generation = 0;
+    for (;;) {
+        const std::function<void(size_t)>* job;
+        {
+            std::unique_lock lock(mutex_);
+            job_ready_.wait(lock, [this, done_generation] {
+                return is_stopping_ || generation_ != done_generation;
+            });
+            if (is_stopping_) {
+                return;
+            }
+            done_generation = generation_;
+            job = job_;
+        }
+
+        try {
+            (*job)(index);
+        } catch (...) {
+            std::lock_guard lock(mutex_);
+            if (!error_) {
+                error_ = std::current_exception();
+            }
+        }
+
+        std::lock_guard lock(mutex_);
+        if (--running_workers_ == 0) {
+            job_done_.notify_one();
+        }
+    }
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads running one job at a time together with the
+// calling thread. Jobs are not queued: Run() returns when every thread is done
+// with the job.
+class ThreadPool {
+public:
+    // The calling thread is counted, so thread_count - 1 workers are started
+    explicit ThreadPool(size_t thread_count);
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    size_t GetThreadCount() const;
+
+    // Calls job(thread index) on every thread, the calling thread has index 0.
+    // The first exception thrown by the job is rethrown here
+    void Run(const std::function<void(size_t)>& job);
+
+    // Calls func(i) for every i in [0, count), threads take blocks of indices in turn
+    template <typename Func>
+    void ParallelFor(size_t count, size_t block_size, Func&& func);
+
+private:
+    void WorkerLoop(size_t index);
+
+    std::vector<std::thread> workers_;
+
+    std::mutex mutex_;
+    std::condition_variable job_ready_;
+    std::condition_variable job_done_;
+    const std::function<void(size_t)>* job_ = nullptr;
+    // incremented for every job, so a worker never takes the same job twice
+    size_t generation_ = 0;
+    size_t running_workers_ = 0;
+    bool is_stopping_ = false;
+    std::exception_ptr error_;
+};
+
+template <typename Func>
+void ThreadPool::ParallelFor(size_t count, size_t block_size, Func&& func) {
+    std::atomic<size_t> next_block{0};
+    Run([&](size_t /* thread index */) {
+        for (;;) {
+            size_t begin = next_block.fetch_add(block_size, std::memory_order_relaxed);
+            if (begin >= count) {
+                return;
+            }
+            size_t end = std::min(begin + block_size, count);
+            for (size_t i = begin; i < end; ++i) {
+                func(i);
+            }
+        }
+    });
+}